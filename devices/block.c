@@ -3,7 +3,10 @@
 #include <string.h>
 #include <stdio.h>
 #include "ide.h"
+#include "../threads/interrupt.h"
 #include "../threads/malloc.h"
+#include "../threads/synch.h"
+#include "../threads/thread.h"
 
 /* A block device. */
 struct block
@@ -17,8 +20,22 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct lock stats_lock;             /* Protects stats. */
+    struct block_stats stats;           /* I/O statistics.  Updated by
+                                           submitters and by the
+                                           driver thread that completes
+                                           requests. */
+  };
+
+/* Names of the I/O classes, for block_print_stats(). */
+static const char *io_class_names[BLOCK_IO_CLASS_CNT] =
+  {
+    "other",
+    "data",
+    "metadata",
+    "swap",
+    "free-map",
+    "journal",
   };
 
 /* List of all block devices. */
@@ -28,6 +45,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static block_complete_func block_complete;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +131,104 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Returns the current value of the CPU's time-stamp counter. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Returns the I/O class of the running code. */
+static enum block_io_class
+current_io_class (void)
+{
+  return intr_context () ? BLOCK_IO_OTHER : thread_current ()->io_class;
+}
+
+/* Sets the I/O class that transfers started by the running
+   thread are accounted to, and returns the previous class so
+   that the caller can restore it. */
+enum block_io_class
+block_set_io_class (enum block_io_class io_class)
+{
+  struct thread *t = thread_current ();
+  enum block_io_class old = t->io_class;
+
+  ASSERT (io_class < BLOCK_IO_CLASS_CNT);
+  t->io_class = io_class;
+  return old;
+}
+
+/* Counts CNT sectors transferred on BLOCK for IO_CLASS. */
+static void
+account_sectors (struct block *block, bool write, size_t cnt,
+                 enum block_io_class io_class)
+{
+  struct block_stats *st = &block->stats;
+  uint64_t bytes = (uint64_t) cnt * BLOCK_SECTOR_SIZE;
+
+  lock_acquire (&block->stats_lock);
+  if (write)
+    {
+      st->write_cnt += cnt;
+      st->write_bytes += bytes;
+    }
+  else
+    {
+      st->read_cnt += cnt;
+      st->read_bytes += bytes;
+    }
+  st->class_bytes[io_class][write] += bytes;
+  lock_release (&block->stats_lock);
+}
+
+/* Notes that a transfer is starting on BLOCK and returns its
+   start time, to be passed to io_end(). */
+static uint64_t
+io_begin (struct block *block)
+{
+  struct block_stats *st = &block->stats;
+
+  lock_acquire (&block->stats_lock);
+  st->depth++;
+  if (st->depth > st->max_depth)
+    st->max_depth = st->depth;
+  st->depth_sum += st->depth;
+  lock_release (&block->stats_lock);
+  return read_tsc ();
+}
+
+/* Notes that a transfer of CNT sectors on BLOCK, started at
+   START, has finished. */
+static void
+io_end (struct block *block, bool write, size_t cnt,
+        enum block_io_class io_class, uint64_t start)
+{
+  struct block_stats *st = &block->stats;
+  uint64_t cycles = read_tsc () - start;
+  int bucket = 0;
+
+  while (bucket < BLOCK_LATENCY_BUCKETS - 1 && (cycles >> (bucket + 1)) != 0)
+    bucket++;
+
+  account_sectors (block, write, cnt, io_class);
+  lock_acquire (&block->stats_lock);
+  st->depth--;
+  if (write)
+    {
+      st->write_reqs++;
+      st->write_latency[bucket]++;
+    }
+  else
+    {
+      st->read_reqs++;
+      st->read_latency[bucket]++;
+    }
+  lock_release (&block->stats_lock);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +236,12 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
+  start = io_begin (block);
   block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  io_end (block, false, 1, current_io_class (), start);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +252,119 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
+  start = io_begin (block);
   block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  io_end (block, true, 1, current_io_class (), start);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK.
+   The I'th sector is stored into BUFFERS[I], each of which must
+   have room for BLOCK_SECTOR_SIZE bytes.  The buffers need not
+   be contiguous in memory.  Devices that support it transfer
+   the whole run with a single command. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *const buffers[])
+{
+  uint64_t start;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  start = io_begin (block);
+  if (block->ops->read_multi != NULL)
+    block->ops->read_multi (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i, buffers[i]);
+  io_end (block, false, cnt, current_io_class (), start);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK,
+   the I'th of which is taken from BUFFERS[I].  Returns after the
+   block device has acknowledged receiving all of the data. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *const buffers[])
+{
+  uint64_t start;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  start = io_begin (block);
+  if (block->ops->write_multi != NULL)
+    block->ops->write_multi (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i, buffers[i]);
+  io_end (block, true, cnt, current_io_class (), start);
+}
+
+/* Submits REQUEST to BLOCK and returns, usually before the
+   transfer is done.  REQUEST->complete is called once all of
+   its sectors have been transferred, from the driver's I/O
+   thread, or from the caller itself if the driver has no queue.  REQUEST->cnt must be between 1 and
+   BLOCK_REQUEST_MAX.
+
+   The request is timed on the first device it is submitted to.
+   A request forwarded to another device, e.g. by a partition to
+   its disk, only adds to that device's sector and byte counts. */
+void
+block_submit (struct block *block, struct block_request *request)
+{
+  ASSERT (request->cnt > 0 && request->cnt <= BLOCK_REQUEST_MAX);
+  check_sector (block, request->sector);
+  check_sector (block, request->sector + request->cnt - 1);
+  ASSERT (!request->write || block->type != BLOCK_FOREIGN);
+
+  if (request->complete != block_complete)
+    {
+      request->done = request->complete;
+      request->complete = block_complete;
+      request->block = block;
+      request->io_class = current_io_class ();
+      request->start = io_begin (block);
+    }
+  else
+    account_sectors (block, request->write, request->cnt, request->io_class);
+
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, request);
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < request->cnt; i++)
+        if (request->write)
+          block->ops->write (block->aux, request->sector + i,
+                             request->buffers[i]);
+        else
+          block->ops->read (block->aux, request->sector + i,
+                            request->buffers[i]);
+      request->complete (request);
+    }
+}
+
+/* Completion function installed by block_submit(): accounts
+   REQUEST to the device it was timed on, then calls the
+   caller's completion function. */
+static void
+block_complete (struct block_request *request)
+{
+  io_end (request->block, request->write, request->cnt,
+          request->io_class, request->start);
+  request->complete = request->done;
+  request->complete (request);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,21 +388,68 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Copies BLOCK's statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  lock_acquire (&block->stats_lock);
+  *stats = block->stats;
+  lock_release (&block->stats_lock);
+
+  strlcpy (stats->name, block->name, sizeof stats->name);
+  stats->type = block->type;
+  stats->size = block->size;
+}
+
+/* Prints the nonempty buckets of latency histogram HIST, which
+   counts transfers in the given DIRECTION. */
+static void
+print_latency (const char *direction, const uint32_t hist[])
+{
+  int i;
+
+  printf ("  %s latency (log2 cycles):", direction);
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" %d:%"PRIu32, i, hist[i]);
+  printf ("\n");
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
 {
-  int i;
+  int i, c;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
-      if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+      struct block_stats st;
+      uint64_t reqs;
+
+      if (block == NULL)
+        continue;
+      block_get_stats (block, &st);
+      printf ("%s (%s): %llu reads, %llu writes\n",
+              block->name, block_type_name (block->type),
+              st.read_cnt, st.write_cnt);
+
+      reqs = st.read_reqs + st.write_reqs;
+      if (reqs == 0)
+        continue;
+      printf ("  %llu bytes read in %llu transfers, "
+              "%llu bytes written in %llu transfers\n",
+              st.read_bytes, st.read_reqs, st.write_bytes, st.write_reqs);
+      for (c = 0; c < BLOCK_IO_CLASS_CNT; c++)
+        if (st.class_bytes[c][0] != 0 || st.class_bytes[c][1] != 0)
+          printf ("  %s: %llu bytes read, %llu bytes written\n",
+                  io_class_names[c], st.class_bytes[c][0],
+                  st.class_bytes[c][1]);
+      print_latency ("read", st.read_latency);
+      print_latency ("write", st.write_latency);
+      printf ("  queue depth: max %"PRIu32", avg %llu.%llu\n",
+              st.max_depth, st.depth_sum / reqs,
+              st.depth_sum * 10 / reqs % 10);
     }
 }
 
@@ -198,8 +473,8 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  lock_init (&block->stats_lock);
+  memset (&block->stats, 0, sizeof block->stats);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -2,7 +2,10 @@
 #define DEVICES_BLOCK_H
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <inttypes.h>
+#include <list.h>
+#include <block-stats.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,10 +56,61 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt,
+                       void *const buffers[]);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        const void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous I/O. */
+
+/* Most sectors a single request may transfer. */
+#define BLOCK_REQUEST_MAX 256
+
+struct block_request;
+
+/* Called when a request finishes, with interrupts on, from the
+   driver's I/O thread or from the submitting thread.  It must
+   not wait for block I/O, or for a lock held across block I/O,
+   because that would stall every request on the channel. */
+typedef void block_complete_func (struct block_request *);
+
+/* An asynchronous request to transfer CNT consecutive sectors
+   starting at SECTOR.  The I'th sector is read into or written
+   from BUFFERS[I].  The caller fills in the first group of
+   members and must keep the request, and its buffers, alive
+   until COMPLETE is called.  Drivers may reorder queued
+   requests and merge adjacent ones into a single command. */
+struct block_request
+  {
+    block_sector_t sector;              /* First sector.  Drivers may
+                                           rewrite it, e.g. partitions
+                                           add their offset. */
+    size_t cnt;                         /* Number of sectors. */
+    bool write;                         /* True to write, false to read. */
+    void *const *buffers;               /* CNT sector-sized buffers. */
+    block_complete_func *complete;      /* Called on completion. */
+    void *aux;                          /* For COMPLETE's use. */
+
+    /* Owned by the block layer while the request is outstanding. */
+    block_complete_func *done;          /* Caller's completion function. */
+    struct block *block;                /* Device the request was timed on. */
+    uint64_t start;                     /* TSC when the request was submitted. */
+    enum block_io_class io_class;       /* Class of the submitting code. */
+
+    /* Owned by the driver while the request is outstanding. */
+    void *driver;                       /* Device the request targets. */
+    struct list_elem elem;              /* Sorted queue or active batch. */
+    struct list_elem fifo_elem;         /* Queue in submission order. */
+    int64_t deadline;                   /* Tick by which to serve it. */
+  };
+
+void block_submit (struct block *, struct block_request *);
+
 /* Statistics. */
+enum block_io_class block_set_io_class (enum block_io_class);
+void block_get_stats (struct block *, struct block_stats *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
@@ -65,6 +119,20 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors starting at the
+       given sector, the I'th of which is in BUFFERS[I], as one
+       request to the device.  If null, the block layer falls
+       back to one read or write per sector. */
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *const buffers[]);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         const void *const buffers[]);
+
+    /* Optional.  Queues REQUEST and returns without waiting for
+       it.  If null, block_submit() does the transfer synchronously
+       and then completes the request. */
+    void (*submit) (void *aux, struct block_request *request);
   };
 
 struct block *block_register (const char *name, enum block_type,
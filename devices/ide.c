@@ -9,6 +9,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +35,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +51,22 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+/* Most sectors a single READ/WRITE command can transfer
+   (a sector count of 0 means 256). */
+#define MAX_CMD_SECTORS BLOCK_REQUEST_MAX
+
+/* Deadlines, in timer ticks, after which a queued request is
+   served ahead of the elevator order.  Reads are usually waited
+   on, so they get the shorter deadline. */
+#define READ_EXPIRE 5
+#define WRITE_EXPIRE 50
+
+/* Most sectors per DRQ block we ask for in multiple mode. */
+#define MAX_MULTIPLE 16
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +75,8 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
   };
 
 /* An ATA channel (aka controller).
@@ -67,11 +87,28 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    /* Request queue.  Requests for both disks wait in QUEUE,
+       sorted by request_key(), and in FIFO in submission order.
+       One command at a time serves the requests in BATCH.  The
+       queue and BATCH are changed only with interrupts off.  While
+       a command is in progress, its data is moved by the channel's
+       I/O thread, which the interrupt handler wakes through
+       PIO_WAIT, so the handler never does PIO itself. */
+    struct list queue;          /* Pending requests, C-LOOK order. */
+    struct list fifo;           /* Pending requests, oldest first. */
+    uint64_t head;              /* Key just past the last dispatched run. */
+    struct list batch;          /* Requests served by the current command. */
+    size_t batch_cnt;           /* Sectors in the current command. */
+    size_t batch_done;          /* Sectors transferred so far. */
+    struct block_request *cur;  /* Request that owns the next sector. */
+    size_t cur_idx;             /* Index of the next sector within CUR. */
+    struct semaphore pio_wait;  /* Up'd when the I/O thread has work. */
+    uint8_t pio_status;         /* Status read by the interrupt handler. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,16 +122,21 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, const char id[]);
+
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool poll_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static void dispatch_request (struct channel *);
+static thread_func io_thread;
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
@@ -123,9 +165,13 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      list_init (&c->queue);
+      list_init (&c->fifo);
+      list_init (&c->batch);
+      c->head = 0;
+      sema_init (&c->pio_wait, 0);
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +182,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
         }
 
       /* Register interrupt handler. */
@@ -148,6 +195,12 @@ ide_init (void)
       if (check_device_type (&c->devices[0]))
         check_device_type (&c->devices[1]);
 
+      /* Start the I/O thread before identify_ata_device() scans
+         the partition table through the request queue. */
+      if ((c->devices[0].is_ata || c->devices[1].is_ata)
+          && thread_create (c->name, PRI_MAX, io_thread, c) == TID_ERROR)
+        PANIC ("%s: could not start I/O thread", c->name);
+
       /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
@@ -303,12 +356,42 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  set_multiple_mode (d, id);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Enables multiple mode on disk D, whose IDENTIFY DEVICE data is
+   ID, so that READ/WRITE MULTIPLE interrupt once per block of
+   sectors instead of once per sector.  Leaves D->multiple at 0
+   if the disk does not support it or rejects the command, in
+   which case multi-sector transfers use READ/WRITE SECTOR. */
+static void
+set_multiple_mode (struct ata_disk *d, const char id[])
+{
+  struct channel *c = d->channel;
+  int max = (uint8_t) id[47 * 2];
+  int cnt;
+
+  /* Use the largest power of 2 the disk supports, up to
+     MAX_MULTIPLE. */
+  for (cnt = MAX_MULTIPLE; cnt > max; cnt /= 2)
+    continue;
+  if (cnt <= 1)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,6 +420,284 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Request queue. */
+
+/* Sort key for REQ: requests for the master sort before those for
+   the slave, then by sector. */
+static inline uint64_t
+request_key (const struct block_request *req)
+{
+  const struct ata_disk *d = req->driver;
+  return ((uint64_t) d->dev_no << 32) | req->sector;
+}
+
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return request_key (a) < request_key (b);
+}
+
+/* Queues REQUEST for disk D and starts it right away if the
+   channel is idle.  REQUEST->complete is called from the
+   channel's I/O thread once the transfer is done. */
+static void
+ide_submit (void *d_, struct block_request *req)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  enum intr_level old_level;
+
+  ASSERT (req->cnt > 0 && req->cnt <= MAX_CMD_SECTORS);
+  req->driver = d;
+  req->deadline = timer_ticks () + (req->write ? WRITE_EXPIRE : READ_EXPIRE);
+
+  old_level = intr_disable ();
+  list_insert_ordered (&c->queue, &req->elem, request_less, NULL);
+  list_push_back (&c->fifo, &req->fifo_elem);
+  if (list_empty (&c->batch))
+    dispatch_request (c);
+  intr_set_level (old_level);
+}
+
+/* Picks the next request for channel C: the oldest request if
+   its deadline has passed, otherwise the first request at or
+   after the head position, wrapping around to the lowest sector
+   (C-LOOK).  Returns a null pointer if the queue is empty. */
+static struct block_request *
+pick_request (struct channel *c)
+{
+  struct list_elem *e;
+  struct block_request *oldest;
+
+  if (list_empty (&c->queue))
+    return NULL;
+
+  oldest = list_entry (list_front (&c->fifo), struct block_request, fifo_elem);
+  if (timer_ticks () >= oldest->deadline)
+    return oldest;
+
+  for (e = list_begin (&c->queue); e != list_end (&c->queue);
+       e = list_next (e))
+    {
+      struct block_request *req = list_entry (e, struct block_request, elem);
+      if (request_key (req) >= c->head)
+        return req;
+    }
+  return list_entry (list_front (&c->queue), struct block_request, elem);
+}
+
+/* Moves sectors between the data register and the current batch:
+   one DRQ block, which is D's multiple count or a single
+   sector. */
+static void
+transfer_block (struct channel *c, struct ata_disk *d, bool write)
+{
+  size_t per_irq = d->multiple > 0 ? (size_t) d->multiple : 1;
+  size_t n = c->batch_cnt - c->batch_done;
+  size_t i;
+
+  if (n > per_irq)
+    n = per_irq;
+  for (i = 0; i < n; i++)
+    {
+      void *buffer = c->cur->buffers[c->cur_idx];
+      if (write)
+        output_sector (c, buffer);
+      else
+        input_sector (c, buffer);
+      if (++c->cur_idx == c->cur->cnt)
+        {
+          struct list_elem *next = list_next (&c->cur->elem);
+          c->cur = (next != list_end (&c->batch)
+                    ? list_entry (next, struct block_request, elem) : NULL);
+          c->cur_idx = 0;
+        }
+    }
+  c->batch_done += n;
+}
+
+/* Starts the next command on channel C, if any request is
+   pending.  Queued requests that continue the chosen one on the
+   same disk, in the same direction, are merged into the same
+   command.  A write's first block is sent by the I/O thread,
+   which is woken right away; a read waits for the disk's
+   interrupt.  Must be called with interrupts off and no command
+   in progress. */
+static void
+dispatch_request (struct channel *c)
+{
+  struct block_request *req = pick_request (c);
+  struct block_request *last;
+  struct ata_disk *d;
+  bool write;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (list_empty (&c->batch));
+  if (req == NULL)
+    return;
+
+  d = req->driver;
+  write = req->write;
+  c->batch_cnt = 0;
+  for (;;)
+    {
+      struct list_elem *next = list_next (&req->elem);
+      list_remove (&req->elem);
+      list_remove (&req->fifo_elem);
+      list_push_back (&c->batch, &req->elem);
+      c->batch_cnt += req->cnt;
+      last = req;
+
+      if (next == list_end (&c->queue))
+        break;
+      req = list_entry (next, struct block_request, elem);
+      if (req->driver != d || req->write != write
+          || req->sector != last->sector + last->cnt
+          || c->batch_cnt + req->cnt > MAX_CMD_SECTORS)
+        break;
+    }
+  c->head = request_key (last) + last->cnt;
+
+  c->batch_done = 0;
+  c->cur = list_entry (list_front (&c->batch), struct block_request, elem);
+  c->cur_idx = 0;
+  select_sector (d, c->cur->sector, c->batch_cnt);
+  c->expecting_interrupt = true;
+  if (write)
+    {
+      outb (reg_command (c), d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                             : CMD_WRITE_SECTOR_RETRY);
+      c->pio_status = 0;
+      sema_up (&c->pio_wait);
+    }
+  else
+    outb (reg_command (c), d->multiple > 0 ? CMD_READ_MULTIPLE
+                                           : CMD_READ_SECTOR_RETRY);
+}
+
+/* Advances the command in progress on channel C each time the
+   command is started or the disk interrupts: reads out the next
+   DRQ block, or sends the next block to write.  When the command
+   is done, starts the next one and then completes all of the
+   finished command's requests.  Runs in its own thread, with
+   interrupts on while sectors are transferred. */
+static void
+io_thread (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct block_request *first;
+      struct ata_disk *d;
+      struct list done;
+      enum intr_level old_level;
+
+      sema_down (&c->pio_wait);
+      first = list_entry (list_front (&c->batch), struct block_request, elem);
+      d = first->driver;
+
+      if (c->pio_status & STA_ERR)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+               first->write ? "write" : "read",
+               first->sector + (block_sector_t) c->batch_done);
+
+      if (c->batch_done < c->batch_cnt)
+        {
+          if (first->write && !poll_while_busy (d) && !wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, first->sector + (block_sector_t) c->batch_done);
+          transfer_block (c, d, first->write);
+          /* A write still waits for the interrupt that acknowledges
+             the block just sent. */
+          if (first->write || c->batch_done < c->batch_cnt)
+            continue;
+        }
+
+      /* Take the finished requests off the channel before starting
+         the next command, so that completion functions, which may
+         wake other threads, run against a consistent queue. */
+      list_init (&done);
+      old_level = intr_disable ();
+      while (!list_empty (&c->batch))
+        list_push_back (&done, list_pop_front (&c->batch));
+      dispatch_request (c);
+      intr_set_level (old_level);
+
+      while (!list_empty (&done))
+        {
+          struct block_request *req = list_entry (list_pop_front (&done),
+                                                  struct block_request, elem);
+          req->complete (req);
+        }
+    }
+}
+
+/* Completion function for synchronous transfers. */
+static void
+complete_sync (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Transfers CNT consecutive sectors starting at SEC_NO between
+   disk D and BUFFERS through the request queue, and waits for
+   the transfer to finish. */
+static void
+transfer_sync (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+               void *const buffers[], bool write)
+{
+  while (cnt > 0)
+    {
+      struct block_request req;
+      struct semaphore done;
+      size_t n = cnt < MAX_CMD_SECTORS ? cnt : MAX_CMD_SECTORS;
+
+      sema_init (&done, 0);
+      req.sector = sec_no;
+      req.cnt = n;
+      req.write = write;
+      req.buffers = buffers;
+      req.complete = complete_sync;
+      req.aux = &done;
+      ide_submit (d, &req);
+      sema_down (&done);
+
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D.
+   The I'th sector goes into BUFFERS[I], which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Uses READ MULTIPLE if it is enabled,
+   otherwise READ SECTOR with a sector count, so each group of up
+   to MAX_CMD_SECTORS sectors costs only one command.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                void *const buffers[])
+{
+  transfer_sync (d_, sec_no, cnt, buffers, false);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D,
+   the I'th of which is taken from BUFFERS[I].  Returns after the
+   disk has acknowledged receiving all of the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                 const void *const buffers[])
+{
+  transfer_sync (d_, sec_no, cnt, (void *const *) buffers, true);
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -344,16 +705,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multi (d_, sec_no, 1, &buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +716,31 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_write_multi (d_, sec_no, 1, &buffer);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi,
+    ide_submit
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_CMD_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_CMD_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -446,7 +793,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,6 +826,26 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Like wait_while_busy(), but busy-waits for at most 100 us, which
+   is usually enough for a disk that has just accepted a command or
+   a block of data, and saves sleeping for a whole timer tick.
+   Returns false if D is still busy, so the caller can fall back to
+   wait_while_busy(). */
+static bool
+poll_while_busy (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 10; i++)
+    {
+      if (!(inb (reg_alt_status (c)) & STA_BSY))
+        return (inb (reg_alt_status (c)) & STA_DRQ) != 0;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +856,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,7 +878,12 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt) 
+        if (!list_empty (&c->batch))
+          {
+            c->pio_status = inb (reg_status (c)); /* Acknowledge interrupt. */
+            sema_up (&c->pio_wait);               /* Wake the I/O thread. */
+          }
+        else if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
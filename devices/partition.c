@@ -317,8 +317,41 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads CNT consecutive sectors starting at SECTOR from
+   partition P into BUFFERS. */
+static void
+partition_read_multi (void *p_, block_sector_t sector, size_t cnt,
+                      void *const buffers[])
+{
+  struct partition *p = p_;
+  block_read_multi (p->block, p->start + sector, cnt, buffers);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to
+   partition P from BUFFERS. */
+static void
+partition_write_multi (void *p_, block_sector_t sector, size_t cnt,
+                       const void *const buffers[])
+{
+  struct partition *p = p_;
+  block_write_multi (p->block, p->start + sector, cnt, buffers);
+}
+
+/* Queues REQUEST, whose sectors are relative to partition P, on
+   the device that contains P. */
+static void
+partition_submit (void *p_, struct block_request *request)
+{
+  struct partition *p = p_;
+  request->sector += p->start;
+  block_submit (p->block, request);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multi,
+    partition_write_multi,
+    partition_submit
   };
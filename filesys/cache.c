@@ -6,364 +6,1035 @@
 #include "../threads/malloc.h"
 #include "../threads/palloc.h"
 #include "../threads/synch.h"
+#include "../threads/thread.h"
 #include "../threads/vaddr.h"
+#include <round.h>
 #include "../devices/block.h"
+#include "../devices/timer.h"
 #include "filesys.h"
+#include "inode.h"
+#include "free-map.h"
+#include "journal.h"
+#include <stdlib.h>
 #include "off_t.h"
 #include "stdbool.h"
 #include "stdio.h"
 
-#define CACHE_SIZE 64
+// 预读队列中最多积压的请求数, 超出后直接丢弃新的预读提示
+#define RA_QUEUE_MAX 16
+// 写回线程一次最多合并写回的连续扇区数
+#define CACHE_FLUSH_BATCH 16
+// 写回线程同时提交给磁盘队列的批次数, 让驱动有机会排序与合并
+#define CACHE_FLUSH_INFLIGHT 4
 
-struct inode_cache_entry
+// Cache的并发控制分为三层:
+// 1. cache_lock: 保护替换算法的状态(2Q的各个队列, 扇区计数, 脏扇区计数, 命中统计)
+// 2. 哈希桶锁: 每个桶一把锁, 保护桶内链表以及桶内cache_entry的pin_cnt
+// 3. cache_entry的读写锁: 保护扇区内容本身
+// 任何时刻最多只持有cache_lock和一把桶锁中的一把, 因此不会死锁
+// 使用扇区内容前必须先pin住cache_entry, pin_cnt > 0的扇区不会被驱逐
+
+// 替换算法使用2Q(Johnson & Shasha, 1994):
+// 第一次被访问的扇区进入FIFO队列A1in, 在A1in中被再次访问不会提升它
+// 从A1in中被驱逐的扇区号记录在幽灵队列A1out中(只记扇区号, 不占cache)
+// 若某扇区在A1out中时再次缺失, 说明它是热数据, 读入后直接进入LRU队列Am
+// 一次大的顺序读只会冲刷A1in, 不会把Am中的目录和索引扇区挤出去
+#define CACHE_MIN_SIZE 8
+#define CACHE_2Q_KIN_PERCENT 25               //A1in占cache的百分比
+#define CACHE_2Q_KOUT_PERCENT 50              //A1out可记录的扇区数占cache的百分比
+
+enum cache_queue
 {
-    bool is_dir;
-    off_t length;                       
-    block_sector_t direct[5];               
-    block_sector_t indirect;
-    block_sector_t double_indirect;
+  CACHE_QUEUE_NONE,                         //不在任何队列中(正在分配)
+  CACHE_QUEUE_A1IN,
+  CACHE_QUEUE_AM
 };
 
 struct cache_sector_node
 {
-  uint8_t cache_idx;
+  size_t cache_idx;
   struct cache_entry *centry;
   void *addr;
-  bool accessed;
+  enum cache_queue queue;             //所在的2Q队列
   bool dirty;
-
-  bool is_inode_sector;
-  uint8_t inode_entry_cnt;
-  struct hash_elem *inode_helem[16];
-  struct list_elem elem;
+  bool prefetched;                    //由预读线程读入, 且尚未被真正读取过
+  bool busy;                          //正在被填充或驱逐, 替换算法必须跳过它
+  bool journaled;                     //属于尚未提交的日志事务, 提交前不能写回原位置
+  int64_t dirty_since;                //变脏的时刻(ticks), 用于判断脏数据的"年龄"
+  enum block_io_class io_class;       //读入或最近一次写入它的I/O类别, 写回时按此统计
+  struct list_elem elem;              //A1in或Am中的链表元素
 };
 
 struct cache_entry
 {
-  bool is_inode;
   block_sector_t sector;
   void *cache_addr;
   struct cache_sector_node *cnode;    //所属的Cache Node
+  int pin_cnt;                        //正在使用该扇区的线程数, 由桶锁保护
+  struct rwlock rwlock;               //保护扇区内容, 填充完成前由填充者持有写锁
+  bool put_write;                     //cache_get()以写模式持有rwlock, cache_put()据此释放
+  struct list_elem belem;             //所在哈希桶中的链表元素
+};
+
+struct cache_bucket
+{
+  struct lock lock;
+  struct list chain;
+};
+
+// A1out中的一项, 只记录被驱逐的扇区号
+struct cache_ghost
+{
+  block_sector_t sector;
   struct hash_elem helem;
+  struct list_elem elem;
 };
 
+// cache的扇区数, 由启动参数-cache=SECTORS设置
+size_t cache_size = CACHE_DEFAULT_SIZE;
+
 void *cache;
-uint8_t cache_sectors_cnt;
+size_t cache_sectors_cnt;
 struct lock cache_lock;
-struct cache_sector_node *free_inode_sector;
-struct hash cache_hashmap;
-struct list cache_list;
-struct list_elem *clist_ptr;
+static struct cache_bucket *cache_buckets;
+static size_t cache_bucket_cnt;             //哈希桶的数目, 是2的幂
 
-static struct cache_sector_node *cache_evict();
-static struct cache_sector_node *cache_get_free_sector(bool is_inode);
-static struct cache_entry *cache_fill(block_sector_t disk_sector, bool is_inode, bool if_read);
+static struct list cache_a1in;
+static struct list cache_am;
+static struct list cache_a1out;
+static struct hash cache_a1out_map;
+static size_t cache_a1in_cnt, cache_a1out_cnt;
+static size_t cache_kin, cache_kout;
 
-bool cache_hash_less(const struct hash_elem *h1, const struct hash_elem *h2, void *aux UNUSED)
-{
-  struct cache_entry *entry1 = hash_entry(h1, struct cache_entry, helem);
-  struct cache_entry *entry2 = hash_entry(h2, struct cache_entry, helem);
-  return (entry1->sector < entry2->sector ? true : false);
-}
+// 2Q的命中统计: 在A1in和Am中的命中数, 缺失数, 以及缺失时命中A1out的次数
+static uint32_t cache_a1in_hit_cnt;
+static uint32_t cache_am_hit_cnt;
+static uint32_t cache_miss_cnt;
+static uint32_t cache_ghost_hit_cnt;
 
-unsigned cache_hash_hash(const struct hash_elem *helem, void *aux UNUSED)
+// 一次预读请求: 预读inode中从第first个扇区开始的cnt个扇区
+struct readahead_req
 {
-  struct cache_entry *entry = hash_entry(helem, struct cache_entry, helem);
-  return hash_bytes(&entry->sector, sizeof(block_sector_t));
-}
+  struct inode *inode;
+  uint32_t first;
+  uint32_t cnt;
+  struct list_elem elem;
+};
+
+static struct list ra_queue;
+static struct lock ra_lock;
+static struct condition ra_cond;
+static size_t ra_queue_len;
+
+// 预读统计: 预读的扇区数, 被命中的扇区数, 未被读取就被驱逐的扇区数
+static uint32_t ra_issued_cnt;
+static uint32_t ra_hit_cnt;
+static uint32_t ra_wasted_cnt;
+
+// 写回线程的可调参数, 见cache.h
+int64_t cache_flush_interval = CACHE_FLUSH_INTERVAL;
+int64_t cache_dirty_age      = CACHE_DIRTY_AGE;
+unsigned cache_dirty_ratio   = CACHE_DIRTY_RATIO;
+// 当前cache中存储文件数据的脏扇区数目
+static size_t cache_dirty_cnt;
+// 当前cache中属于未提交事务的扇区数目, 以及因cache不足被提前写回的这类扇区数目
+static size_t cache_journaled_cnt;
+static uint32_t cache_journal_spill_cnt;
+
+static void cache_readahead_daemon(void *aux);
+static void cache_flush_daemon(void *aux);
+static struct cache_sector_node *cache_evict(void);
+static unsigned cache_ghost_hash(const struct hash_elem *e, void *aux);
+static bool cache_ghost_less(const struct hash_elem *a, const struct hash_elem *b, void *aux);
+static struct cache_sector_node *cache_get_free_sector(void);
+static void cache_fill(struct cache_entry *centry, bool if_read);
 
 void
 cache_init(void)
 {
-  list_init(&cache_list);
+  if (cache_size < CACHE_MIN_SIZE)
+    PANIC("cache_init(): Cache must have at least %d sectors", CACHE_MIN_SIZE);
+
   lock_init(&cache_lock);
-  hash_init(&cache_hashmap, cache_hash_hash, cache_hash_less, NULL);
-  clist_ptr = list_end(&cache_list);
-  cache = palloc_get_multiple(PAL_ZERO, ((CACHE_SIZE * BLOCK_SECTOR_SIZE) / PGSIZE));
-  free_inode_sector = cache_get_free_sector(true);
+  list_init(&cache_a1in);
+  list_init(&cache_am);
+  list_init(&cache_a1out);
+  hash_init(&cache_a1out_map, cache_ghost_hash, cache_ghost_less, NULL);
+  cache_kin  = cache_size * CACHE_2Q_KIN_PERCENT / 100;
+  cache_kout = cache_size * CACHE_2Q_KOUT_PERCENT / 100;
+
+  // 让每个桶平均不超过2个扇区, 查找的代价与cache大小无关
+  for (cache_bucket_cnt = 16; cache_bucket_cnt * 2 < cache_size; )
+    cache_bucket_cnt *= 2;
+  cache_buckets = malloc(cache_bucket_cnt * sizeof *cache_buckets);
+  if (cache_buckets == NULL)
+    PANIC("cache_init(): Cannot allocate memory for cache buckets");
+  for (size_t i = 0; i < cache_bucket_cnt; i++)
+  {
+    lock_init(&cache_buckets[i].lock);
+    list_init(&cache_buckets[i].chain);
+  }
+
+  cache = palloc_get_multiple(PAL_ZERO, DIV_ROUND_UP(cache_size * BLOCK_SECTOR_SIZE, PGSIZE));
   if (cache == NULL)
-    PANIC("cache_init(): Cannot allocate memory for cache");
+    PANIC("cache_init(): Cannot allocate memory for %zu cache sectors", cache_size);
+
+  list_init(&ra_queue);
+  lock_init(&ra_lock);
+  cond_init(&ra_cond);
+  if (thread_create("read-ahead", PRI_DEFAULT, cache_readahead_daemon, NULL) == TID_ERROR)
+    PANIC("cache_init(): Cannot create read-ahead thread");
+  if (thread_create("write-behind", PRI_DEFAULT, cache_flush_daemon, NULL) == TID_ERROR)
+    PANIC("cache_init(): Cannot create write-behind thread");
+}
+
+static inline struct cache_bucket *
+cache_bucket_of(block_sector_t sector)
+{
+  return &cache_buckets[hash_bytes(&sector, sizeof sector) & (cache_bucket_cnt - 1)];
+}
+
+static unsigned
+cache_ghost_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_ghost *g = hash_entry(e, struct cache_ghost, helem);
+  return hash_bytes(&g->sector, sizeof g->sector);
+}
+
+static bool
+cache_ghost_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  return hash_entry(a, struct cache_ghost, helem)->sector
+         < hash_entry(b, struct cache_ghost, helem)->sector;
+}
+
+// 将从A1in中驱逐的扇区号记入A1out, A1out满时丢弃最老的一项
+// 调用者必须持有cache_lock
+static void
+cache_ghost_add(block_sector_t sector)
+{
+  struct cache_ghost *g;
+
+  if (cache_kout == 0)
+    return ;
+  if (cache_a1out_cnt >= cache_kout)
+  {
+    g = list_entry(list_pop_front(&cache_a1out), struct cache_ghost, elem);
+    hash_delete(&cache_a1out_map, &g->helem);
+    cache_a1out_cnt--;
+  }
+  else if ((g = malloc(sizeof *g)) == NULL)
+    return ;
+
+  g->sector = sector;
+  if (hash_insert(&cache_a1out_map, &g->helem) != NULL)
+  {
+    // 扇区号已经在A1out中了
+    free(g);
+    return ;
+  }
+  list_push_back(&cache_a1out, &g->elem);
+  cache_a1out_cnt++;
+}
+
+// 若sector在A1out中, 将其移出并返回true
+// 调用者必须持有cache_lock
+static bool
+cache_ghost_take(block_sector_t sector)
+{
+  struct cache_ghost key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_delete(&cache_a1out_map, &key.helem);
+  if (e == NULL)
+    return false;
+  struct cache_ghost *g = hash_entry(e, struct cache_ghost, helem);
+  list_remove(&g->elem);
+  cache_a1out_cnt--;
+  free(g);
+  return true;
+}
+
+// 将新读入的扇区放入2Q的队列中, 调用者必须持有cache_lock
+static void
+cache_policy_insert(struct cache_sector_node *cnode, block_sector_t sector)
+{
+  ASSERT(cnode->queue == CACHE_QUEUE_NONE);
+  if (cache_ghost_take(sector))
+  {
+    cache_ghost_hit_cnt++;
+    cnode->queue = CACHE_QUEUE_AM;
+    list_push_back(&cache_am, &cnode->elem);
+  }
+  else
+  {
+    cnode->queue = CACHE_QUEUE_A1IN;
+    list_push_back(&cache_a1in, &cnode->elem);
+    cache_a1in_cnt++;
+  }
+}
+
+// 记录一次命中: Am中的扇区移到LRU队尾, A1in中的扇区保持不动
+// 调用者必须持有cache_lock
+static void
+cache_policy_touch(struct cache_sector_node *cnode)
+{
+  if (cnode->queue == CACHE_QUEUE_AM)
+  {
+    cache_am_hit_cnt++;
+    list_remove(&cnode->elem);
+    list_push_back(&cache_am, &cnode->elem);
+  }
+  else if (cnode->queue == CACHE_QUEUE_A1IN)
+    cache_a1in_hit_cnt++;
 }
 
-inline static bool 
-cache_full()
+// 将被驱逐的扇区移出2Q的队列, 从A1in中驱逐的扇区号记入A1out
+// 调用者必须持有cache_lock
+static void
+cache_policy_remove(struct cache_sector_node *cnode, block_sector_t sector)
 {
-  return cache_sectors_cnt >= CACHE_SIZE - 1;
+  ASSERT(cnode->queue != CACHE_QUEUE_NONE);
+  list_remove(&cnode->elem);
+  if (cnode->queue == CACHE_QUEUE_A1IN)
+  {
+    cache_a1in_cnt--;
+    cache_ghost_add(sector);
+  }
+  cnode->queue = CACHE_QUEUE_NONE;
 }
 
+// 在桶中查找sector对应的cache_entry, 调用者必须持有桶锁
 static struct cache_entry *
-cache_seek(block_sector_t sector)
+cache_bucket_find(struct cache_bucket *b, block_sector_t sector)
 {
-  struct cache_entry key_entry;
-  key_entry.sector = sector;
+  struct list_elem *e;
+  for (e = list_begin(&b->chain); e != list_end(&b->chain); e = list_next(e))
+  {
+    struct cache_entry *centry = list_entry(e, struct cache_entry, belem);
+    if (centry->sector == sector)
+      return centry;
+  }
+  return NULL;
+}
 
-  struct hash_elem *helem = hash_find(&cache_hashmap, &key_entry.helem);
-  if (helem == NULL)
-    return NULL;
+// 若sector在cache中, 将其pin住后返回, 否则返回NULL
+static struct cache_entry *
+cache_lookup_pin(block_sector_t sector)
+{
+  struct cache_bucket *b = cache_bucket_of(sector);
+  lock_acquire(&b->lock);
+  struct cache_entry *centry = cache_bucket_find(b, sector);
+  if (centry != NULL)
+    centry->pin_cnt++;
+  lock_release(&b->lock);
+  return centry;
+}
 
-  return hash_entry(helem, struct cache_entry, helem);
+static void
+cache_unpin(struct cache_entry *centry)
+{
+  struct cache_bucket *b = cache_bucket_of(centry->sector);
+  lock_acquire(&b->lock);
+  ASSERT(centry->pin_cnt > 0);
+  centry->pin_cnt--;
+  lock_release(&b->lock);
 }
 
-// 返回一个可用的cnode节点
-static struct cache_sector_node *
-cache_get_free_sector(bool is_inode)
+// 返回sector对应的, 已经pin住的cache_entry. 不在cache中时先插入一个占位的entry,
+// 由当前线程持有其写锁完成填充, 其他查找到它的线程会阻塞在读写锁上直到填充完成
+// 若prefetch为true且扇区是新读入的, 将其标记为预读扇区
+static struct cache_entry *
+cache_get_entry(block_sector_t sector, bool if_read, bool prefetch)
 {
-  struct cache_sector_node *cnode; 
-  uint8_t sector_idx;
-  if (!cache_full())
+  struct cache_bucket *b = cache_bucket_of(sector);
+  struct cache_entry *centry;
+
+  lock_acquire(&b->lock);
+  centry = cache_bucket_find(b, sector);
+  if (centry != NULL)
+  {
+    centry->pin_cnt++;
+    lock_release(&b->lock);
+    // 预读命中cache中已有的扇区不算作一次访问
+    // cnode为NULL说明其他线程还在填充该扇区, 填充时会将它放入队列
+    if (!prefetch)
     {
-      cnode = calloc(1, sizeof(struct cache_sector_node));
-      sector_idx = ++cache_sectors_cnt;
+      lock_acquire(&cache_lock);
+      if (centry->cnode != NULL)
+        cache_policy_touch(centry->cnode);
+      lock_release(&cache_lock);
     }
-  else
+    return centry;
+  }
+
+  centry = calloc(1, sizeof *centry);
+  if (centry == NULL)
+    PANIC("cache_get_entry(): Cannot allocate memory for cache entry");
+  centry->sector   = sector;
+  centry->pin_cnt  = 1;
+  rwlock_init(&centry->rwlock);
+  rwlock_acquire_write(&centry->rwlock);
+  list_push_back(&b->chain, &centry->belem);
+  lock_release(&b->lock);
+
+  cache_fill(centry, if_read);
+  if (prefetch)
+  {
+    centry->cnode->prefetched = true;
+    ra_issued_cnt++;
+  }
+  rwlock_release_write(&centry->rwlock);
+  return centry;
+}
+
+// 返回一个可用的cnode节点, 返回的cnode处于busy状态且不在任何2Q队列中
+// cnode在填充完成后由cache_fill()放入队列并解除busy
+static struct cache_sector_node *
+cache_get_free_sector(void)
+{
+  struct cache_sector_node *cnode = NULL;
+
+  lock_acquire(&cache_lock);
+  if (cache_sectors_cnt < cache_size)
+  {
+    cnode = calloc(1, sizeof(struct cache_sector_node));
+    ASSERT(cnode != NULL);
+    cnode->cache_idx = cache_sectors_cnt++;
+    cnode->addr      = cache + cnode->cache_idx * BLOCK_SECTOR_SIZE;
+    cnode->queue     = CACHE_QUEUE_NONE;
+    cnode->busy      = true;
+  }
+  lock_release(&cache_lock);
+
+  if (cnode == NULL)
     cnode = cache_evict();
 
   ASSERT(cnode != NULL);
-  cnode->is_inode_sector  = is_inode;
-  cnode->addr             = cnode->addr == NULL ? cache + sector_idx * BLOCK_SECTOR_SIZE : cnode->addr;
   cnode->centry           = NULL;
-  cnode->cache_idx        = sector_idx;
+  cnode->prefetched       = false;
+  memset(cnode->addr, 0, BLOCK_SECTOR_SIZE);
 
   return cnode;
 }
 
-void *
-cache_find_inode(block_sector_t sector)
+// 当前线程访问普通扇区时的I/O类别, 未指定时视为文件数据
+static enum block_io_class
+cache_io_class(void)
 {
-  void *cache_addr;
-  struct cache_entry *centry = cache_seek(sector);
-  if (centry == NULL)
-    cache_addr = cache_fill (sector, true, true);
-  else
+  enum block_io_class io_class = thread_current()->io_class;
+  return io_class == BLOCK_IO_OTHER ? BLOCK_IO_DATA : io_class;
+}
+
+// 从磁盘中读入数据到cache中, 并设置好centry指向的内存地址
+// 若if_read为true, 则从磁盘中读取数据, 否则填充0
+// 调用者必须持有centry的写锁
+static void
+cache_fill(struct cache_entry *centry, bool if_read)
+{
+  struct cache_sector_node *cnode = cache_get_free_sector();
+  cnode->io_class = cache_io_class();
+  // 直接读入cache, 此时cnode处于busy状态, 不会被其他线程驱逐
+  if (if_read)
   {
-    ASSERT(centry->is_inode);
-    cache_addr = centry->cache_addr;
+    enum block_io_class old = block_set_io_class(cnode->io_class);
+    block_read(fs_device, centry->sector, cnode->addr);
+    block_set_io_class(old);
   }
-  ASSERT(cache_addr != NULL);
+  cnode->centry      = centry;
+  cnode->dirty       = false;
 
-  return cache_addr;
+  lock_acquire(&cache_lock);
+  centry->cnode      = cnode;
+  centry->cache_addr = cnode->addr;
+  cnode->busy        = false;
+  cache_policy_insert(cnode, centry->sector);
+  cache_miss_cnt++;
+  lock_release(&cache_lock);
 }
 
-//向某个存储inode元数据的cache_sector中添加inode元数据
-static void *
-cache_add_inode(struct inode_cache_entry *inode_entry, struct cache_entry *centry)
+//重置cnode的脏标志位, 扇区已经写回原位置, 不再属于任何日志事务
+static void
+cache_clear_dirty(struct cache_sector_node *cnode)
 {
-  // 如果当前存储inode的sector已满
-  if (free_inode_sector->inode_entry_cnt == BLOCK_SECTOR_SIZE / sizeof(struct inode_cache_entry))
-    free_inode_sector = cache_get_free_sector(true);
+  lock_acquire(&cache_lock);
+  if (cnode->dirty)
+    cache_dirty_cnt--;
+  if (cnode->journaled)
+    cache_journaled_cnt--;
+  cnode->dirty     = false;
+  cnode->journaled = false;
+  lock_release(&cache_lock);
+}
 
-  free_inode_sector->inode_entry_cnt++;
-  free_inode_sector->centry = NULL;  
-  void *addr = free_inode_sector->addr + free_inode_sector->inode_entry_cnt * sizeof(struct inode_cache_entry);
-  // 向addr中写入inode_entry的内容
-  free_inode_sector->inode_helem[free_inode_sector->inode_entry_cnt - 1] = &centry->helem;
-  centry->cnode = free_inode_sector;
-  *(struct inode_cache_entry *)addr = *inode_entry;
-  return addr;
+//将cache中某个sector的内容写回
+//调用者必须pin住cnode->centry并持有其读锁或写锁
+static void
+cache_writeback(struct cache_sector_node *cnode)
+{
+  enum block_io_class old = block_set_io_class(cnode->io_class);
+  block_write(fs_device, cnode->centry->sector, cnode->addr);
+  block_set_io_class(old);
+  cache_clear_dirty(cnode);
 }
 
+static int
+cache_sector_cmp(const void *a_, const void *b_)
+{
+  block_sector_t a = *(const block_sector_t *)a_;
+  block_sector_t b = *(const block_sector_t *)b_;
+  return a < b ? -1 : a > b;
+}
 
-// 从磁盘中读入数据到cache中, 返回已经写入内存的文件内容的内存地址
-// 若if_read为true, 则从磁盘中读取数据
-static struct cache_entry *
-cache_fill(block_sector_t disk_sector, bool is_inode, bool if_read)
+// 写回线程提交给磁盘的一批连续脏扇区
+struct cache_flush_io
 {
-  void *buffer = calloc(1, BLOCK_SECTOR_SIZE);
-  if (if_read)
-    block_read(fs_device, disk_sector, buffer);
+  struct block_request req;
+  struct semaphore *done;
+  struct cache_entry *batch[CACHE_FLUSH_BATCH];
+  void *buffers[CACHE_FLUSH_BATCH];
+};
+
+// 磁盘完成一批写回后由驱动的I/O线程调用, 不能等待磁盘I/O, 只唤醒写回线程
+static void
+cache_flush_complete(struct block_request *req)
+{
+  struct cache_flush_io *io = req->aux;
+  sema_up(io->done);
+}
 
-  struct cache_entry *centry = calloc(1, sizeof(struct cache_entry));
-  ASSERT(centry != NULL);
+// 等待已提交的k批写回完成, 然后清除脏标记, 释放读锁并unpin
+static void
+cache_flush_wait(struct cache_flush_io *ios, size_t k, struct semaphore *done)
+{
+  for (size_t i = 0; i < k; i++)
+    sema_down(done);
+  for (size_t i = 0; i < k; i++)
+    for (size_t j = 0; j < ios[i].req.cnt; j++)
+    {
+      struct cache_entry *centry = ios[i].batch[j];
+      cache_clear_dirty(centry->cnode);
+      rwlock_release_read(&centry->rwlock);
+      cache_unpin(centry);
+    }
+}
+
+// 写回cache中的脏扇区
+// 若all为false, 只写回脏了超过cache_dirty_age个tick的扇区
+// 被选中的扇区按扇区号升序写回, 让磁头单向移动
+// 扇区号连续的脏扇区(最多CACHE_FLUSH_BATCH个)合并成一条多扇区写命令
+// 每批作为一个异步请求提交, 最多CACHE_FLUSH_INFLIGHT批同时在磁盘队列中
+// 写回时只pin住这些扇区并持有它们的读锁, 不影响其他扇区的读写
+static void
+cache_flush(bool all)
+{
+  struct list_elem *e;
+  struct cache_sector_node *cnode;
+  block_sector_t *sectors;
+  struct cache_flush_io *ios;
+  struct semaphore done;
+  size_t cnt = 0, k = 0;
+  int64_t now = timer_ticks();
+
+  lock_acquire(&cache_lock);
+  if (cache_dirty_cnt == 0
+      || (sectors = malloc(cache_dirty_cnt * sizeof *sectors)) == NULL)
+  {
+    lock_release(&cache_lock);
+    return ;
+  }
+  struct list *queues[] = {&cache_a1in, &cache_am};
+  for (int i = 0; i < 2; i++)
+    for (e = list_begin(queues[i]); e != list_end(queues[i]); e = list_next(e))
+    {
+      cnode = list_entry(e, struct cache_sector_node, elem);
+      if (cnode->dirty && !cnode->busy && !cnode->journaled && cnode->centry != NULL
+          && (all || now - cnode->dirty_since >= cache_dirty_age))
+        sectors[cnt++] = cnode->centry->sector;
+    }
+  lock_release(&cache_lock);
 
-  if (is_inode)
+  ios = malloc(CACHE_FLUSH_INFLIGHT * sizeof *ios);
+  if (ios == NULL)
   {
-    struct inode_cache_entry *inode_entry = buffer;
-    centry->is_inode    = true;
-    centry->sector      = disk_sector;
-    centry->cache_addr  = cache_add_inode(inode_entry, centry);
+    free(sectors);
+    return ;
   }
-  else 
+  sema_init(&done, 0);
+
+  qsort(sectors, cnt, sizeof *sectors, cache_sector_cmp);
+  size_t i = 0;
+  while (i < cnt)
   {
-    struct cache_sector_node *cnode = cache_get_free_sector(false);
-    cnode->centry           = centry;
-    centry->cnode           = cnode;
-    centry->is_inode        = false;
-    centry->sector          = disk_sector;
-    centry->cache_addr      = cnode->addr;
-    //向cache中写入数据
-    memcpy(cnode->addr, buffer, BLOCK_SECTOR_SIZE);
-    // 只有当cache满时我们才将新的cnode压入list中
-    if (!cache_full())
-      list_push_back(&cache_list, &cnode->elem);
+    struct cache_flush_io *io = &ios[k];
+    size_t n = 0;
+
+    // 收集一段扇区号连续且依然是脏的扇区
+    while (i < cnt && n < CACHE_FLUSH_BATCH
+           && (n == 0 || sectors[i] == sectors[i - 1] + 1))
+    {
+      // 扇区可能在收集之后被驱逐, 驱逐时已经写回
+      struct cache_entry *centry = cache_lookup_pin(sectors[i++]);
+      if (centry == NULL)
+        break;
+      rwlock_acquire_read(&centry->rwlock);
+      if (!centry->cnode->dirty || centry->cnode->journaled)
+      {
+        rwlock_release_read(&centry->rwlock);
+        cache_unpin(centry);
+        break;
+      }
+      // 不同类别的扇区分批提交, 以便按类别统计; 该扇区留给下一批
+      if (n > 0 && centry->cnode->io_class != io->batch[0]->cnode->io_class)
+      {
+        rwlock_release_read(&centry->rwlock);
+        cache_unpin(centry);
+        i--;
+        break;
+      }
+      io->batch[n] = centry;
+      io->buffers[n] = centry->cache_addr;
+      n++;
+    }
+    if (n == 0)
+      continue;
+
+    io->done = &done;
+    io->req.sector = io->batch[0]->sector;
+    io->req.cnt = n;
+    io->req.write = true;
+    io->req.buffers = io->buffers;
+    io->req.complete = cache_flush_complete;
+    io->req.aux = io;
+    enum block_io_class old = block_set_io_class(io->batch[0]->cnode->io_class);
+    block_submit(fs_device, &io->req);
+    block_set_io_class(old);
+    if (++k == CACHE_FLUSH_INFLIGHT)
+    {
+      cache_flush_wait(ios, k, &done);
+      k = 0;
+    }
   }
-  hash_insert(&cache_hashmap, &centry->helem);
-  free(buffer);
-  // TODO: 添加返回false的情况!
-  return centry;
+  cache_flush_wait(ios, k, &done);
+  free(ios);
+  free(sectors);
 }
 
-//将cache中某个sector的内容写回
-static void
-cache_writeback(struct cache_sector_node *cnode)
+// 若sector在cache中且是脏的, 立即将其写回磁盘
+// 属于未提交事务的扇区不写回, 它们由提交时的checkpoint写回
+void
+cache_sync(block_sector_t sector)
 {
-  // 保证cnode指向的一定是一个存储正常文件数据的sector, 而不是存储inode的
-  ASSERT(!cnode->is_inode_sector)
-  block_write(fs_device, cnode->centry->sector, cnode->addr);
-  //重置cnode的标志位
-  cnode->dirty    = false;
-  cnode->accessed = false;
+  struct cache_entry *centry = cache_lookup_pin(sector);
+  if (centry == NULL)
+    return ;
+  rwlock_acquire_read(&centry->rwlock);
+  if (centry->cnode->dirty && !centry->cnode->journaled)
+    cache_writeback(centry->cnode);
+  rwlock_release_read(&centry->rwlock);
+  cache_unpin(centry);
 }
 
 void
 cache_writeback_all(void)
 {
-  struct list_elem *e;
-  struct cache_sector_node *cnode;
-  uint8_t cnt = 0;
+  cache_flush(true);
+}
+
+// 返回cache中属于未提交日志事务的扇区数目
+size_t
+cache_journal_cnt(void)
+{
+  lock_acquire(&cache_lock);
+  size_t cnt = cache_journaled_cnt;
+  lock_release(&cache_lock);
+  return cnt;
+}
+
+// 将属于未提交事务的扇区号存入sectors(最多max个), 返回这类扇区的总数
+// 总数大于max时调用者应当分配更大的数组重试
+// 调用者必须保证此时没有线程在修改元数据(见journal_commit())
+size_t
+cache_journal_sectors(block_sector_t *sectors, size_t max)
+{
+  size_t cnt = 0;
 
   lock_acquire(&cache_lock);
-  for (e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e))
+  struct list *queues[] = {&cache_a1in, &cache_am};
+  for (int i = 0; i < 2; i++)
+    for (struct list_elem *e = list_begin(queues[i]); e != list_end(queues[i]);
+         e = list_next(e))
+    {
+      struct cache_sector_node *cnode = list_entry(e, struct cache_sector_node, elem);
+      if (cnode->journaled && cnode->centry != NULL)
+      {
+        if (cnt < max)
+          sectors[cnt] = cnode->centry->sector;
+        cnt++;
+      }
+    }
+  lock_release(&cache_lock);
+  return cnt;
+}
+
+// 事务提交后, 将其中的扇区写回原位置(checkpoint), 写回后它们不再属于任何事务
+void
+cache_journal_checkpoint(const block_sector_t *sectors, size_t cnt)
+{
+  for (size_t i = 0; i < cnt; i++)
   {
-    cnode = list_entry(e, struct cache_sector_node, elem);
-    if (!cnode->is_inode_sector)
-      cache_writeback(cnode);
+    struct cache_entry *centry = cache_lookup_pin(sectors[i]);
+    if (centry == NULL)
+      continue;
+    rwlock_acquire_read(&centry->rwlock);
+    if (centry->cnode->dirty)
+      cache_writeback(centry->cnode);
+    else
+      cache_clear_dirty(centry->cnode);
+    rwlock_release_read(&centry->rwlock);
+    cache_unpin(centry);
+  }
+}
+
+// 写回线程: 每隔cache_flush_interval个tick醒来一次
+// 脏扇区占比超过cache_dirty_ratio%时写回全部脏扇区, 否则只写回足够"老"的脏扇区
+static void
+cache_flush_daemon(void *aux UNUSED)
+{
+  for (;;)
+  {
+    timer_sleep(cache_flush_interval);
+
+    lock_acquire(&cache_lock);
+    bool over_ratio = cache_dirty_cnt * 100 >= cache_dirty_ratio * (size_t) cache_sectors_cnt;
+    lock_release(&cache_lock);
+    // 先提交日志(其中会把内存中的inode元数据写入cache), 再写回free map和其他脏扇区
+    journal_commit();
+    free_map_flush();
+    cache_flush(over_ratio);
+  }
+}
+
+// 预读扇区第一次被真正读取时计为一次预读命中
+// 调用者持有centry的读锁或写锁. 多个读者可能同时到达这里,
+// 因此在桶锁下检查并清除prefetched, 保证每次预读最多计一次命中
+static void
+cache_note_ra_hit(struct cache_entry *centry)
+{
+  struct cache_bucket *b = cache_bucket_of(centry->sector);
+
+  // prefetched只会在持有写锁时被置位, 读锁下看到false就不可能再变成true
+  if (!centry->cnode->prefetched)
+    return;
+  lock_acquire(&b->lock);
+  bool hit = centry->cnode->prefetched;
+  centry->cnode->prefetched = false;
+  lock_release(&b->lock);
+
+  if (hit)
+  {
+    lock_acquire(&cache_lock);
+    ra_hit_cnt++;
+    lock_release(&cache_lock);
   }
-  lock_release(&cache_lock);
 }
 
 // 从cache中读取某块数据
-// 在cache中寻找某个disk_sector对应的内容, 会留下访问痕迹(accessed位)
+// 在cache中寻找某个disk_sector对应的内容, 命中会记录到2Q的队列中
 // 如果找不到要读取的内容, 就从磁盘中读取内容, 再返回
+// 预读由read-ahead线程异步完成, 见cache_readahead()
 void 
-cache_read(block_sector_t disk_sector, void *buffer, bool is_inode)
+cache_read(block_sector_t disk_sector, void *buffer)
 {
-  void *cache_addr;
-  struct cache_entry *centry = cache_seek(disk_sector);
-  if (centry == NULL)
-    centry = cache_fill(disk_sector, is_inode, true);
+  struct cache_entry *centry = cache_get_entry(disk_sector, true, false);
 
-  // 保证我们不会将一个inode节点当成普通文件来读取, 或者反之
-  ASSERT((is_inode ^ centry->is_inode) == 0)
+  rwlock_acquire_read(&centry->rwlock);
+  cache_note_ra_hit(centry);
+  memcpy(buffer, centry->cache_addr, BLOCK_SECTOR_SIZE);
+  rwlock_release_read(&centry->rwlock);
+  cache_unpin(centry);
+}
 
-  centry->cnode->accessed = true;
-  cache_addr = centry->cache_addr;
+// 将centry所在的扇区标记为脏, 调用者必须持有centry的写锁
+static void
+cache_mark_dirty(struct cache_entry *centry)
+{
+  struct cache_sector_node *cnode = centry->cnode;
 
-  if (is_inode)
-    memcpy(buffer, cache_addr, sizeof(struct inode_cache_entry));
-  else
+  if (!cnode->dirty)
   {
-    memcpy(buffer, cache_addr, BLOCK_SECTOR_SIZE);
-    // TODO: 异步地进行read_ahead
-    // cache_fill(disk_sector + 1, is_inode, true);
+    lock_acquire(&cache_lock);
+    cnode->dirty_since = timer_ticks();
+    cache_dirty_cnt++;
+    lock_release(&cache_lock);
+  }
+  cnode->dirty      = true;
+  cnode->prefetched = false;
+  cnode->io_class   = cache_io_class();
+  // 元数据和free map的修改先进入日志, 提交之前不能写回原位置
+  if ((cnode->io_class == BLOCK_IO_META || cnode->io_class == BLOCK_IO_FREE_MAP)
+      && !cnode->journaled && journal_enabled())
+  {
+    lock_acquire(&cache_lock);
+    cnode->journaled = true;
+    cache_journaled_cnt++;
+    lock_release(&cache_lock);
   }
 }
 
 // 向cache中写入某块数据
 // 如果找不到要写入的内容, 就先写入到cache, 随后在某个时机写回到磁盘
 void 
-cache_write(block_sector_t disk_sector, const void *buffer, bool is_inode)
+cache_write(block_sector_t disk_sector, const void *buffer)
 {
-  void *cache_addr;
-  struct cache_entry *centry = cache_seek(disk_sector);
-  if (centry == NULL)
-    centry = cache_fill(disk_sector, is_inode, false);
-
-  // 保证我们不会将一个inode节点当成普通文件来读取, 或者反之
-  ASSERT((is_inode ^ centry->is_inode) == 0)
-  // 因为我们不可能将第一次写入缓存的inode写回到磁盘中(wirteback()不支持inode sector)
-  // 因此我们对于inode要采用写穿(write through)策略: 在这里直接写入磁盘
-  if (is_inode)
-    block_write(fs_device, disk_sector, buffer);
-  
-  centry->cnode->accessed = true;
-  centry->cnode->dirty    = true; 
-  cache_addr = centry->cache_addr;
+  struct cache_entry *centry = cache_get_entry(disk_sector, false, false);
+
+  rwlock_acquire_write(&centry->rwlock);
+  cache_mark_dirty(centry);
+  memcpy(centry->cache_addr, buffer, BLOCK_SECTOR_SIZE);
+  rwlock_release_write(&centry->rwlock);
+  cache_unpin(centry);
+}
 
-  if (is_inode)
-    memcpy(cache_addr, buffer, sizeof(struct inode_cache_entry));
+// 返回cache中存放文件数据扇区sector的内存地址, 不在cache中时先从磁盘读入
+// 返回前pin住该扇区, write为true时持有写锁, 否则持有读锁
+// 调用者可以直接在cache中读取或修改数据, 省去一次缓冲区拷贝, 用完后必须调用cache_put()
+// 持有期间不要对同一扇区再次调用cache_get(), 也不要长时间持有
+void *
+cache_get(block_sector_t sector, bool write)
+{
+  struct cache_entry *centry = cache_get_entry(sector, true, false);
+
+  if (write)
+  {
+    rwlock_acquire_write(&centry->rwlock);
+    centry->put_write = true;
+  }
+  else
+    rwlock_acquire_read(&centry->rwlock);
+
+  cache_note_ra_hit(centry);
+  return centry->cache_addr;
+}
+
+// 释放cache_get()取得的扇区, dirty为true时将扇区标记为脏(要求以写模式取得)
+void
+cache_put(block_sector_t sector, bool dirty)
+{
+  struct cache_bucket *b = cache_bucket_of(sector);
+
+  // 调用者持有pin, 扇区一定还在cache中
+  lock_acquire(&b->lock);
+  struct cache_entry *centry = cache_bucket_find(b, sector);
+  lock_release(&b->lock);
+  ASSERT(centry != NULL && centry->pin_cnt > 0);
+
+  if (centry->put_write)
+  {
+    if (dirty)
+      cache_mark_dirty(centry);
+    centry->put_write = false;
+    rwlock_release_write(&centry->rwlock);
+  }
   else
-    memcpy(cache_addr, buffer, BLOCK_SECTOR_SIZE);
+  {
+    ASSERT(!dirty);
+    rwlock_release_read(&centry->rwlock);
+  }
+  cache_unpin(centry);
+}
+
+// 从queue的头部开始寻找第一个可以驱逐的扇区, 调用者必须持有cache_lock
+// 正在填充/驱逐的扇区以及被pin住的扇区会被跳过
+// 属于未提交事务的扇区只有在journaled为true时才会被选中
+static struct cache_sector_node *
+cache_scan_victim(struct list *queue, bool journaled)
+{
+  struct list_elem *e;
+  for (e = list_begin(queue); e != list_end(queue); e = list_next(e))
+  {
+    struct cache_sector_node *cnode = list_entry(e, struct cache_sector_node, elem);
+    if (!cnode->busy && cnode->centry != NULL && cnode->centry->pin_cnt == 0
+        && (journaled || !cnode->journaled))
+      return cnode;
+  }
+  return NULL;
 }
 
+// 2Q的替换: A1in超过cache_kin时驱逐A1in中最早进入的扇区, 否则驱逐Am中最久未使用的扇区
+// 首选队列中没有可驱逐的扇区时退而使用另一个队列, 全部不可用时返回NULL
+// 调用者必须持有cache_lock
 static struct cache_sector_node *
-cache_which_to_evict()
+cache_which_to_evict(bool journaled)
 {
-  ASSERT(cache_full());
-  ASSERT(clist_ptr != NULL);
+  struct cache_sector_node *cnode;
+
+  if (cache_a1in_cnt > cache_kin)
+  {
+    if ((cnode = cache_scan_victim(&cache_a1in, journaled)) == NULL)
+      cnode = cache_scan_victim(&cache_am, journaled);
+  }
+  else if ((cnode = cache_scan_victim(&cache_am, journaled)) == NULL)
+    cnode = cache_scan_victim(&cache_a1in, journaled);
+  return cnode;
+}
 
-  bool second_turn = false;
-  struct list_elem *old_ptr = clist_ptr->prev;
+// 驱逐一个存放文件数据的扇区, 返回处于busy状态, 已经与原扇区解除关联的cnode
+// 脏扇区先在pin住的情况下写回, 写回完成且确认没有其他线程使用后
+// 才从哈希桶中移除, 保证其他线程不会从磁盘读到旧数据
+static struct cache_sector_node *
+cache_evict(void)
+{
   struct cache_sector_node *cnode;
+  struct cache_entry *centry;
+  struct cache_bucket *b;
 
-  for(;;)
+  for (;;)
   {
-    if(clist_ptr == list_end(&cache_list))
-      clist_ptr = list_begin(&cache_list);
-    
-    cnode = list_entry(clist_ptr, struct cache_sector_node, elem);
-    bool accessed = cnode->accessed;
-    bool dirty    = cnode->dirty;
-    
-    if (clist_ptr == old_ptr)
-      second_turn = true;
-    
-    if (!second_turn)
+    lock_acquire(&cache_lock);
+    cnode = cache_which_to_evict(false);
+    // 其余扇区都属于未提交的事务. 当前线程可能正处于事务中, 无法等待提交,
+    // 只能提前写回其中一个, 放弃这个扇区的崩溃一致性(日志事务的阈值使这种情况很少发生)
+    if (cnode == NULL && (cnode = cache_which_to_evict(true)) != NULL)
+      cache_journal_spill_cnt++;
+    if (cnode == NULL)
     {
-      if (!accessed && !dirty)
-      {
-        // 每次驱逐后应该更新指针
-        clist_ptr = list_next(clist_ptr);
-        return cnode;
-      }
+      // 所有扇区都正在被使用, 让出CPU等待其他线程释放
+      lock_release(&cache_lock);
+      thread_yield();
+      continue;
     }
-    else 
+    cnode->busy = true;
+    centry = cnode->centry;
+    lock_release(&cache_lock);
+
+    b = cache_bucket_of(centry->sector);
+    lock_acquire(&b->lock);
+    if (centry->pin_cnt > 0)
     {
-      if (!accessed)
-      {
-        clist_ptr = list_next(clist_ptr);
-        return cnode;
-      }
-      cnode->accessed = false;
+      lock_release(&b->lock);
+      cnode->busy = false;
+      continue;
     }
+    centry->pin_cnt++;
+    lock_release(&b->lock);
 
-    clist_ptr = list_next(clist_ptr);
+    if (cnode->dirty)
+    {
+      rwlock_acquire_read(&centry->rwlock);
+      cache_writeback(cnode);
+      rwlock_release_read(&centry->rwlock);
+    }
+
+    lock_acquire(&b->lock);
+    if (centry->pin_cnt > 1 || cnode->dirty)
+    {
+      // 写回期间又有线程使用了该扇区, 换一个扇区驱逐
+      centry->pin_cnt--;
+      lock_release(&b->lock);
+      cnode->busy = false;
+      continue;
+    }
+    list_remove(&centry->belem);
+    lock_release(&b->lock);
+    break;
   }
+
+  lock_acquire(&cache_lock);
+  cache_policy_remove(cnode, centry->sector);
+  // 预读进来的扇区还没被读取就要被驱逐了, 这次预读白做了
+  if (cnode->prefetched)
+    ra_wasted_cnt++;
+  lock_release(&cache_lock);
+
+  cnode->dirty      = false;
+  cnode->prefetched = false;
+  cnode->centry     = NULL;
+  free(centry);
+  
+  return cnode;
 }
 
-static struct cache_sector_node *
-cache_evict()
+// 将sector预先读入cache, 若已在cache中则什么也不做
+static void
+cache_prefetch(block_sector_t sector)
 {
-  struct cache_sector_node *cnode = cache_which_to_evict();
-  
-  lock_acquire(&cache_lock);
-  if(cnode->dirty && !cnode->is_inode_sector)
-    cache_writeback(cnode);
+  cache_unpin(cache_get_entry(sector, true, true));
+}
 
-  cnode->accessed = false;
-  cnode->dirty    = false;
+// 向预读线程提交一次预读提示, 由inode_read_at()在检测到顺序读取时调用
+// 请求持有inode的一个引用, 保证预读完成前inode不会被释放
+// 队列已满时直接丢弃提示, 预读只是优化, 丢掉也不影响正确性
+void
+cache_readahead(struct inode *inode, uint32_t first, uint32_t cnt)
+{
+  struct readahead_req *req;
 
-  if (!cnode->is_inode_sector)
+  lock_acquire(&ra_lock);
+  if (ra_queue_len >= RA_QUEUE_MAX || (req = malloc(sizeof *req)) == NULL)
   {
-    struct hash_elem *helem = hash_delete(&cache_hashmap, &cnode->centry->helem);
-    ASSERT(helem != NULL);
-    free(cnode->centry);
-    cnode->centry = NULL;
+    lock_release(&ra_lock);
+    return ;
   }
-  else 
+  req->inode = inode_reopen(inode);
+  req->first = first;
+  req->cnt   = cnt;
+  list_push_back(&ra_queue, &req->elem);
+  ra_queue_len++;
+  cond_signal(&ra_cond, &ra_lock);
+  lock_release(&ra_lock);
+}
+
+// 预读线程: 不断从ra_queue中取出请求, 通过byte_to_sector()找到文件扇区
+// 并将其读入cache. 每个扇区单独加锁, 用户进程的读取可以穿插其中
+static void
+cache_readahead_daemon(void *aux UNUSED)
+{
+  struct readahead_req *req;
+
+  for (;;)
   {
-    for (int i = 0; i < cnode->inode_entry_cnt; i++)
+    lock_acquire(&ra_lock);
+    while (list_empty(&ra_queue))
+      cond_wait(&ra_cond, &ra_lock);
+    req = list_entry(list_pop_front(&ra_queue), struct readahead_req, elem);
+    ra_queue_len--;
+    lock_release(&ra_lock);
+
+    for (uint32_t i = 0; i < req->cnt; i++)
     {
-      struct cache_entry *inode_centry = hash_entry(cnode->inode_helem[i], struct cache_entry, helem);
-      struct hash_elem *helem = hash_delete(&cache_hashmap, cnode->inode_helem[i]);
-      ASSERT(helem != NULL);
-      free(inode_centry);
+      off_t pos = (off_t)(req->first + i) * BLOCK_SECTOR_SIZE;
+      // 文件可能在提交请求后被截短, 不能预读EOF之后的内容
+      if (pos >= inode_length(req->inode))
+        break;
+      // 空洞中没有需要读取的扇区
+      // 查找扇区时持有inode的读锁, 避免与延长文件的写入同时修改extent
+      rwlock_acquire_read(&req->inode->rwlock);
+      block_sector_t sector = byte_to_sector(req->inode, pos);
+      rwlock_release_read(&req->inode->rwlock);
+      if (sector != 0)
+        cache_prefetch(sector);
     }
 
-    cnode->is_inode_sector = false;
-    cnode->inode_entry_cnt = 0;
-    memset(cnode->inode_helem, 0, sizeof(cnode->inode_helem));
+    inode_close(req->inode);
+    free(req);
   }
-  lock_release(&cache_lock);
-  
-  return cnode;
+}
+
+void
+cache_print_stats(void)
+{
+  uint32_t hit_cnt = cache_a1in_hit_cnt + cache_am_hit_cnt;
+  uint32_t access_cnt = hit_cnt + cache_miss_cnt;
+
+  printf("Cache: %zu sectors, 2Q: %"PRIu32" hits in A1in, %"PRIu32" hits in Am, "
+         "%"PRIu32" misses (%"PRIu32" in A1out), hit rate %"PRIu32"%%\n",
+         cache_size, cache_a1in_hit_cnt, cache_am_hit_cnt, cache_miss_cnt,
+         cache_ghost_hit_cnt, access_cnt == 0 ? 0 : hit_cnt * 100 / access_cnt);
+  printf("Cache: %"PRIu32" sectors read ahead, %"PRIu32" hits, %"PRIu32" wasted\n",
+         ra_issued_cnt, ra_hit_cnt, ra_wasted_cnt);
+  if (cache_journal_spill_cnt > 0)
+    printf("Cache: %"PRIu32" uncommitted metadata sectors written back early\n",
+           cache_journal_spill_cnt);
 }
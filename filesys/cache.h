@@ -2,12 +2,41 @@
 #define FILESYS_CACHE_H
 
 #include "stdbool.h"
+#include <stddef.h>
+#include <stdint.h>
 #include "../devices/block.h"
 
+// cache的默认扇区数, 可以用启动参数-cache=SECTORS修改
+#define CACHE_DEFAULT_SIZE 64
+
+// 预读窗口的初始大小与上限, 单位为扇区
+#define CACHE_RA_INIT_WINDOW 4
+#define CACHE_RA_MAX_WINDOW 32
+
+// 写回线程的默认参数: 唤醒间隔与脏数据最大"年龄"的单位均为tick
+// 脏扇区占cache的百分比超过CACHE_DIRTY_RATIO时, 写回线程会写回全部脏扇区
+#define CACHE_FLUSH_INTERVAL 50
+#define CACHE_DIRTY_AGE 100
+#define CACHE_DIRTY_RATIO 50
+
+extern size_t cache_size;
+extern int64_t cache_flush_interval;
+extern int64_t cache_dirty_age;
+extern unsigned cache_dirty_ratio;
+
+struct inode;
+
 void cache_init(void);
 void cache_writeback_all(void);
-void cache_read(block_sector_t disk_sector, void *buffer, bool is_inode);
-void cache_write(block_sector_t disk_sector, const void *buffer, bool is_inode);
-void *cache_find_inode(block_sector_t sector);
+void cache_sync(block_sector_t sector);
+void cache_read(block_sector_t disk_sector, void *buffer);
+void cache_write(block_sector_t disk_sector, const void *buffer);
+void *cache_get(block_sector_t sector, bool write);
+void cache_put(block_sector_t sector, bool dirty);
+size_t cache_journal_cnt(void);
+size_t cache_journal_sectors(block_sector_t *sectors, size_t max);
+void cache_journal_checkpoint(const block_sector_t *sectors, size_t cnt);
+void cache_readahead(struct inode *inode, uint32_t first, uint32_t cnt);
+void cache_print_stats(void);
 
 #endif // !FILESYS_CACHE_H
@@ -0,0 +1,168 @@
+#include "dentry.h"
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "directory.h"
+#include "../threads/malloc.h"
+#include "../threads/synch.h"
+
+// dentry cache: 缓存路径解析的结果, 以(父目录inode的扇区号, 名字)为键
+// 命中时不需要打开父目录, 也不需要读取目录文件中的任何扇区
+// 目录中不存在的名字也会被缓存(negative entry, sector为0), 反复查找不存在的文件同样不访问磁盘
+// 目录发生变化时由dir_add()/dir_remove()使相应的项失效
+// 项数超过DENTRY_CACHE_MAX时按LRU淘汰
+struct dentry
+{
+  block_sector_t parent;              // 父目录inode所在的扇区
+  char name[NAME_MAX + 1];
+  block_sector_t sector;              // 文件inode所在的扇区, 0表示目录中没有这个名字
+  bool is_dir;
+  struct hash_elem helem;
+  struct list_elem lru_elem;          // dentry_lru中的链表元素, 链表头是最近使用的项
+};
+
+static struct hash dentry_map;
+static struct list dentry_lru;
+static size_t dentry_cnt;
+static struct lock dentry_lock;
+
+static unsigned
+dentry_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry(e, struct dentry, helem);
+  return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+static bool
+dentry_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry(a_, struct dentry, helem);
+  const struct dentry *b = hash_entry(b_, struct dentry, helem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp(a->name, b->name) < 0;
+}
+
+void
+dentry_init(void)
+{
+  hash_init(&dentry_map, dentry_hash, dentry_less, NULL);
+  list_init(&dentry_lru);
+  dentry_cnt = 0;
+  lock_init(&dentry_lock);
+}
+
+// 查找(parent, name)对应的项, 调用者必须持有dentry_lock
+static struct dentry *
+dentry_find(block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen(name) > NAME_MAX)
+    return NULL;
+  key.parent = parent;
+  strlcpy(key.name, name, sizeof key.name);
+  e = hash_find(&dentry_map, &key.helem);
+  return e != NULL ? hash_entry(e, struct dentry, helem) : NULL;
+}
+
+// 删除一项, 调用者必须持有dentry_lock
+static void
+dentry_delete(struct dentry *d)
+{
+  hash_delete(&dentry_map, &d->helem);
+  list_remove(&d->lru_elem);
+  dentry_cnt--;
+  free(d);
+}
+
+// 在目录parent中查找name
+// 命中时将文件inode的扇区号存入*SECTOR, 是否为目录存入*IS_DIR
+enum dentry_result
+dentry_lookup(block_sector_t parent, const char *name,
+              block_sector_t *sector, bool *is_dir)
+{
+  enum dentry_result result = DENTRY_MISS;
+
+  lock_acquire(&dentry_lock);
+  struct dentry *d = dentry_find(parent, name);
+  if (d != NULL)
+  {
+    list_remove(&d->lru_elem);
+    list_push_front(&dentry_lru, &d->lru_elem);
+    if (d->sector == 0)
+      result = DENTRY_NEGATIVE;
+    else
+    {
+      *sector = d->sector;
+      *is_dir = d->is_dir;
+      result = DENTRY_HIT;
+    }
+  }
+  lock_release(&dentry_lock);
+  return result;
+}
+
+// 记录目录parent中name对应的文件, sector为0表示目录中没有name
+void
+dentry_insert(block_sector_t parent, const char *name,
+              block_sector_t sector, bool is_dir)
+{
+  if (strlen(name) > NAME_MAX)
+    return ;
+
+  lock_acquire(&dentry_lock);
+  struct dentry *d = dentry_find(parent, name);
+  if (d == NULL)
+  {
+    // 超出上限时淘汰最久未使用的项
+    if (dentry_cnt >= DENTRY_CACHE_MAX)
+      dentry_delete(list_entry(list_back(&dentry_lru), struct dentry, lru_elem));
+    d = malloc(sizeof *d);
+    if (d == NULL)
+    {
+      lock_release(&dentry_lock);
+      return ;
+    }
+    d->parent = parent;
+    strlcpy(d->name, name, sizeof d->name);
+    hash_insert(&dentry_map, &d->helem);
+    dentry_cnt++;
+  }
+  else
+    list_remove(&d->lru_elem);
+  d->sector = sector;
+  d->is_dir = is_dir;
+  list_push_front(&dentry_lru, &d->lru_elem);
+  lock_release(&dentry_lock);
+}
+
+// 目录parent中name对应的项发生了变化, 删除缓存的项
+void
+dentry_invalidate(block_sector_t parent, const char *name)
+{
+  lock_acquire(&dentry_lock);
+  struct dentry *d = dentry_find(parent, name);
+  if (d != NULL)
+    dentry_delete(d);
+  lock_release(&dentry_lock);
+}
+
+// 目录parent被删除, 删除以它为父目录的所有项
+// 否则它的扇区被新目录重用后, 旧的项(包括negative entry)会被错误地命中
+void
+dentry_invalidate_dir(block_sector_t parent)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire(&dentry_lock);
+  for (e = list_begin(&dentry_lru); e != list_end(&dentry_lru); e = next)
+  {
+    struct dentry *d = list_entry(e, struct dentry, lru_elem);
+    next = list_next(e);
+    if (d->parent == parent)
+      dentry_delete(d);
+  }
+  lock_release(&dentry_lock);
+}
@@ -0,0 +1,26 @@
+#ifndef FILESYS_DENTRY_H
+#define FILESYS_DENTRY_H
+
+#include <stdbool.h>
+#include "../devices/block.h"
+
+// dentry cache最多缓存的目录项数
+#define DENTRY_CACHE_MAX 256
+
+// dentry_lookup()的结果
+enum dentry_result
+{
+  DENTRY_MISS,                  // 不在cache中, 需要查找目录
+  DENTRY_HIT,                   // 目录中有这个名字
+  DENTRY_NEGATIVE               // 目录中没有这个名字
+};
+
+void dentry_init(void);
+enum dentry_result dentry_lookup(block_sector_t parent, const char *name,
+                                 block_sector_t *sector, bool *is_dir);
+void dentry_insert(block_sector_t parent, const char *name,
+                   block_sector_t sector, bool is_dir);
+void dentry_invalidate(block_sector_t parent, const char *name);
+void dentry_invalidate_dir(block_sector_t parent);
+
+#endif // !FILESYS_DENTRY_H
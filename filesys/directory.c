@@ -3,9 +3,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include "dentry.h"
 #include "filesys.h"
 #include "inode.h"
+#include "journal.h"
 #include "../threads/malloc.h"
+#include "../threads/synch.h"
 #include "stdbool.h"
 
 /* A directory. */
@@ -25,10 +29,66 @@ struct dir_entry
     // 而不是 "文件是否正在被使用" !
   };
 
+// 目录项较多时, 目录文件由线性格式转换为哈希索引格式(可扩展哈希, 思路类似ext3的htree)
+// 索引格式的布局:
+//   扇区0: dir_index_header
+//   扇区1 ~ DIR_INDEX_TABLE_SECTORS: 哈希表, 第i项是哈希值低depth位等于i的目录项所在的桶号
+//   之后每个扇区是一个桶
+// 查找, 插入和删除只需读取头部, 哈希表中的一项和一个桶, 与目录大小无关
+// 线性格式目录的第一个目录项总是".", 而索引格式的头部以一个空闲目录项开头,
+// 因此第一个目录项空闲且magic正确的目录就是索引格式, 小目录仍然使用原来的线性格式
+#define DIR_INDEX_MAGIC 0x58444948            // "HIDX"
+#define DIR_INDEX_MAX_DEPTH 10                // 哈希表最多有2^10项
+#define DIR_INDEX_TABLE_SECTORS \
+  ((sizeof (uint32_t) << DIR_INDEX_MAX_DEPTH) / BLOCK_SECTOR_SIZE)
+#define DIR_INDEX_FIRST_BUCKET (1 + DIR_INDEX_TABLE_SECTORS)
+// 线性格式的目录最多容纳的目录项数, 再添加目录项时转换为索引格式
+#define DIR_LINEAR_MAX 64
+
+struct dir_index_header
+  {
+    struct dir_entry unused;            /* in_use为false. */
+    uint32_t magic;
+    uint32_t depth;                     /* 全局深度, 哈希表的前2^depth项有效. */
+    uint32_t bucket_cnt;                /* 已分配的桶数, 包括溢出桶. */
+  };
+
+#define DIR_BUCKET_ENTRIES \
+  ((BLOCK_SECTOR_SIZE - 2 * sizeof (uint32_t)) / sizeof (struct dir_entry))
+
+// 一个桶恰好占一个扇区
+// 局部深度为depth的桶中, 所有目录项的哈希值低depth位都相同
+// 只有局部深度达到DIR_INDEX_MAX_DEPTH的桶装满后, 才会链接溢出桶
+struct dir_bucket
+  {
+    uint32_t depth;                     /* 局部深度. */
+    uint32_t next;                      /* 溢出桶的桶号加1, 0表示没有. */
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+  };
+
+static bool dir_index_add (struct inode *, struct dir_index_header *,
+                           const struct dir_entry *);
+
+static bool dir_lookup_sector (block_sector_t parent, const char *name,
+                               block_sector_t *sector, bool *is_dir);
+
+// 目录的读写锁: 查找和读取目录项持有读锁, 添加和删除目录项持有写锁
+// 单个目录项的读写已经由目录inode的读写锁保证原子性, 这把锁保证的是
+// "检查重名再写入"以及索引目录分裂桶这样的多步修改不会被其他线程看到中间状态
+// 加锁顺序: dir_rwlock -> inode的读写锁 -> free map的锁
+static struct rwlock dir_rwlock;
+
+void
+dir_init (void)
+{
+  rwlock_init (&dir_rwlock);
+}
+
 // 返回路径中最后一个文件的inode的sector编号
 // 若未找到, 则返回0
 // Example: path_ = /path/to/some/file/ 
 // 返回file的inode所在的sector编号
+// 每个路径分量先查dentry cache, 命中时不需要打开任何目录
 block_sector_t
 dir_parse(block_sector_t wd, const char *path_)
 {
@@ -36,50 +96,32 @@ dir_parse(block_sector_t wd, const char *path_)
   if (!path_ || !strlen(path_))
     return wd;
 
-  uint32_t path_len = strlen(path_) + 1; 
-  char path[64];
+  char *path = malloc(strlen(path_) + 1);
   char *token, *save_ptr;
-  struct dir *dir = NULL;
-
-  strlcpy(path, path_, path_len);
+  if (path == NULL)
+    return 0;
+  strlcpy(path, path_, strlen(path_) + 1);
 
-  // 如果path的首位为"/"
-  bool relative = (*path != '/');
-  block_sector_t ret = relative ? 0 : ROOT_DIR_SECTOR;
-  // 是否为相对路径
-  struct inode *inode = relative ? inode_open(wd) : inode_open(ROOT_DIR_SECTOR);
-  if (inode == NULL) goto done;
-  dir = dir_open(inode);
-  if (dir == NULL) goto done;
+  // 如果path的首位为"/", 则从根目录开始, 否则从工作目录开始
+  // 如果path = "/"(根目录), 不会进入for循环
+  block_sector_t cur = (*path != '/') ? wd : ROOT_DIR_SECTOR;
+  bool cur_is_dir = true;
 
   // 逐个解码path
-  // 如果path = "/"(根目录), 不会进入for循环
   // strtok_r的实现保证了不会有任何token的长度为0, 可以自适应"a///b/c"的情况
   for (token = strtok_r (path, "/", &save_ptr); token != NULL;
         token = strtok_r (NULL, "/", &save_ptr))
   {
-    // 前一次循环无法打开dir, 而又运行到了这一次循环
-    // 说明path没到头, 而上一个token已经不是directory了(因为dir是NULL),
-    // 是错误的, 应该返回0
-    if(dir == NULL) goto done;
-    // 每次lookup都会打开新的inode, 如果能找到文件的话
-    dir_lookup(dir, token, &inode); 
-    // dir已经在lookup中用完了, 需要手动关闭
-    // 注意, dir_close也同时关闭了旧的inode
-    dir_close(dir);
-    dir = NULL;
+    // path没到头, 而上一个token已经不是directory了, 是错误的, 应该返回0
     // 如果在path中找不到名为token的文件, 那么也返回0
-    if (inode == NULL) goto done;
-    ret = inode->sector;
-    // 这里的inode是在lookup中找到的新inode
-    dir = dir_open(inode);
+    if (!cur_is_dir || !dir_lookup_sector(cur, token, &cur, &cur_is_dir))
+    {
+      cur = 0;
+      break;
+    }
   }
-  // 得到返回值
-  if (dir) dir_close(dir);
-  return ret;
-done:
-  if (dir) dir_close(dir);
-  return 0;
+  free(path);
+  return cur;
 }
 
 /* Creates a directory with space for ENTRY_CNT entries in the
@@ -87,8 +129,13 @@ done:
 bool
 dir_create (block_sector_t sector, block_sector_t prev, const char *name, size_t entry_cnt)
 {
+  // 新目录的inode, "."和".."以及父目录中的目录项在同一个事务中
+  journal_begin();
   if(!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
+  {
+    journal_end();
     return false;
+  }
   struct inode *new_inode = inode_open(sector);
   ASSERT(new_inode != NULL);
   struct dir *new_dir = dir_open(new_inode);
@@ -96,6 +143,7 @@ dir_create (block_sector_t sector, block_sector_t prev, const char *name, size_t
   dir_add(new_dir, ".", sector);
   dir_add(new_dir, "..", prev);
   dir_add(prev_dir, name, sector);
+  journal_end();
   return true;
 }
 
@@ -154,6 +202,19 @@ dir_close (struct dir *dir)
     }
 }
 
+// 设置和返回readdir的当前位置, 供系统调用在多次调用之间保存位置
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  dir->pos = pos;
+}
+
+off_t
+dir_tell (const struct dir *dir)
+{
+  return dir->pos;
+}
+
 /* Returns the inode encapsulated by DIR. */
 struct inode *
 dir_get_inode (struct dir *dir) 
@@ -161,6 +222,265 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+// 目录项名字的哈希值
+// 桶的选择依赖于哈希值的低位, 而FNV的低位只取决于各字符的低位, 所以再混合一次
+static uint32_t
+dir_hash (const char *name)
+{
+  uint32_t h = hash_string (name);
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  return h;
+}
+
+// 第b个桶在目录文件中的偏移
+static off_t
+dir_bucket_ofs (uint32_t b)
+{
+  return (off_t) (DIR_INDEX_FIRST_BUCKET + b) * BLOCK_SECTOR_SIZE;
+}
+
+// 第b个桶中第slot个目录项在目录文件中的偏移
+static off_t
+dir_slot_ofs (uint32_t b, size_t slot)
+{
+  return dir_bucket_ofs (b) + offsetof (struct dir_bucket, entries)
+         + slot * sizeof (struct dir_entry);
+}
+
+// 读取目录的头部, 目录是索引格式时返回true
+static bool
+dir_index_read_header (struct inode *inode, struct dir_index_header *hdr)
+{
+  return inode_read_at (inode, hdr, sizeof *hdr, 0) == sizeof *hdr
+         && !hdr->unused.in_use && hdr->magic == DIR_INDEX_MAGIC;
+}
+
+static bool
+dir_index_write_header (struct inode *inode, const struct dir_index_header *hdr)
+{
+  return inode_write_at (inode, hdr, sizeof *hdr, 0) == sizeof *hdr;
+}
+
+static bool
+dir_bucket_read (struct inode *inode, uint32_t b, struct dir_bucket *bucket)
+{
+  return inode_read_at (inode, bucket, sizeof *bucket, dir_bucket_ofs (b))
+         == sizeof *bucket;
+}
+
+static bool
+dir_bucket_write (struct inode *inode, uint32_t b,
+                  const struct dir_bucket *bucket)
+{
+  return inode_write_at (inode, bucket, sizeof *bucket, dir_bucket_ofs (b))
+         == sizeof *bucket;
+}
+
+// 返回哈希值为h的目录项所在的第一个桶的桶号
+static uint32_t
+dir_index_bucket_of (struct inode *inode, const struct dir_index_header *hdr,
+                     uint32_t h)
+{
+  uint32_t idx = h & ((1u << hdr->depth) - 1);
+  uint32_t b = 0;
+  inode_read_at (inode, &b, sizeof b,
+                 BLOCK_SECTOR_SIZE + idx * sizeof (uint32_t));
+  return b;
+}
+
+// 在索引格式的目录中查找NAME, 语义与lookup()相同
+static bool
+dir_index_lookup (struct inode *inode, const struct dir_index_header *hdr,
+                  const char *name, struct dir_entry *ep, off_t *ofsp)
+{
+  struct dir_bucket *bucket = malloc (sizeof *bucket);
+  uint32_t b = dir_index_bucket_of (inode, hdr, dir_hash (name));
+  bool found = false;
+
+  if (bucket == NULL)
+    return false;
+  for (;;)
+  {
+    if (!dir_bucket_read (inode, b, bucket))
+      break;
+    for (size_t i = 0; i < DIR_BUCKET_ENTRIES; i++)
+      if (bucket->entries[i].in_use && !strcmp (name, bucket->entries[i].name))
+      {
+        if (ep != NULL)
+          *ep = bucket->entries[i];
+        if (ofsp != NULL)
+          *ofsp = dir_slot_ofs (b, i);
+        found = true;
+        goto done;
+      }
+    if (bucket->next == 0)
+      break;
+    b = bucket->next - 1;
+  }
+done:
+  free (bucket);
+  return found;
+}
+
+// 将第b个桶(局部深度为BUCKET->depth)分裂为两个桶
+// 局部深度等于全局深度时先将哈希表加倍
+static bool
+dir_index_split (struct inode *inode, struct dir_index_header *hdr,
+                 uint32_t b, struct dir_bucket *bucket)
+{
+  uint32_t ld = bucket->depth;
+  size_t table_size = sizeof (uint32_t) << (hdr->depth + (ld == hdr->depth));
+  uint32_t *table = malloc (table_size);
+  struct dir_bucket *sibling = calloc (1, sizeof *sibling);
+  bool success = false;
+
+  if (table == NULL || sibling == NULL)
+    goto done;
+  if (inode_read_at (inode, table, sizeof (uint32_t) << hdr->depth,
+                     BLOCK_SECTOR_SIZE) != (off_t) sizeof (uint32_t) << hdr->depth)
+    goto done;
+  if (ld == hdr->depth)
+  {
+    size_t n = (size_t) 1 << hdr->depth;
+    for (size_t i = 0; i < n; i++)
+      table[i + n] = table[i];
+    hdr->depth++;
+  }
+
+  // 哈希值第ld位为1的目录项移到新桶中
+  uint32_t nb = hdr->bucket_cnt++;
+  bucket->depth = sibling->depth = ld + 1;
+  for (size_t i = 0; i < DIR_BUCKET_ENTRIES; i++)
+    if (bucket->entries[i].in_use && (dir_hash (bucket->entries[i].name) >> ld) & 1)
+    {
+      sibling->entries[i] = bucket->entries[i];
+      bucket->entries[i].in_use = false;
+    }
+  for (size_t i = 0; i < ((size_t) 1 << hdr->depth); i++)
+    if (table[i] == b && (i >> ld) & 1)
+      table[i] = nb;
+
+  // 先写新桶, 再修改哈希表和头部, 最后写回旧桶
+  success = dir_bucket_write (inode, nb, sibling)
+            && inode_write_at (inode, table, table_size, BLOCK_SECTOR_SIZE)
+               == (off_t) table_size
+            && dir_index_write_header (inode, hdr)
+            && dir_bucket_write (inode, b, bucket);
+done:
+  free (sibling);
+  free (table);
+  return success;
+}
+
+// 向索引格式的目录中插入目录项E, 调用者需保证E->name不在目录中
+// 目标桶已满时分裂它, 局部深度已达上限时链接一个溢出桶
+static bool
+dir_index_add (struct inode *inode, struct dir_index_header *hdr,
+               const struct dir_entry *e)
+{
+  struct dir_bucket *bucket = malloc (sizeof *bucket);
+  uint32_t h = dir_hash (e->name);
+  bool success = false;
+
+  if (bucket == NULL)
+    return false;
+  for (;;)
+  {
+    uint32_t head = dir_index_bucket_of (inode, hdr, h);
+    uint32_t b = head;
+    uint32_t head_depth;
+
+    // 在整条溢出链上找一个空闲的位置
+    if (!dir_bucket_read (inode, b, bucket))
+      goto done;
+    head_depth = bucket->depth;
+    for (;;)
+    {
+      for (size_t i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (!bucket->entries[i].in_use)
+        {
+          success = inode_write_at (inode, e, sizeof *e, dir_slot_ofs (b, i))
+                    == sizeof *e;
+          goto done;
+        }
+      if (bucket->next == 0)
+        break;
+      b = bucket->next - 1;
+      if (!dir_bucket_read (inode, b, bucket))
+        goto done;
+    }
+
+    if (head_depth < DIR_INDEX_MAX_DEPTH)
+    {
+      // 溢出链只会出现在深度已达上限的桶上, 此时b == head
+      if (!dir_index_split (inode, hdr, head, bucket))
+        goto done;
+      continue;
+    }
+
+    // 链接一个溢出桶, E放在其中
+    uint32_t nb = hdr->bucket_cnt++;
+    bucket->next = nb + 1;
+    struct dir_bucket *overflow = calloc (1, sizeof *overflow);
+    if (overflow == NULL)
+      goto done;
+    overflow->depth = head_depth;
+    overflow->entries[0] = *e;
+    success = dir_bucket_write (inode, nb, overflow)
+              && dir_index_write_header (inode, hdr)
+              && dir_bucket_write (inode, b, bucket);
+    free (overflow);
+    goto done;
+  }
+done:
+  free (bucket);
+  return success;
+}
+
+// 将线性格式的目录转换为索引格式, 并重新插入所有目录项
+// 先写好桶0来延长文件, 空间不足时目录保持线性格式不变
+static bool
+dir_index_convert (struct inode *inode)
+{
+  off_t length = inode_length (inode);
+  struct dir_entry *entries = malloc (length);
+  void *zeros = calloc (DIR_INDEX_TABLE_SECTORS, BLOCK_SECTOR_SIZE);
+  struct dir_index_header hdr;
+  bool success = false;
+
+  if (entries == NULL || zeros == NULL
+      || inode_read_at (inode, entries, length, 0) != length)
+    goto done;
+
+  // 桶0: 局部深度为0, 没有目录项
+  if (inode_write_at (inode, zeros, BLOCK_SECTOR_SIZE, dir_bucket_ofs (0))
+      != BLOCK_SECTOR_SIZE)
+    goto done;
+  // 哈希表只有一项, 指向桶0
+  if (inode_write_at (inode, zeros, DIR_INDEX_TABLE_SECTORS * BLOCK_SECTOR_SIZE,
+                      BLOCK_SECTOR_SIZE)
+      != DIR_INDEX_TABLE_SECTORS * BLOCK_SECTOR_SIZE)
+    goto done;
+  memset (&hdr, 0, sizeof hdr);
+  hdr.magic = DIR_INDEX_MAGIC;
+  hdr.depth = 0;
+  hdr.bucket_cnt = 1;
+  if (inode_write_at (inode, zeros, BLOCK_SECTOR_SIZE, 0) != BLOCK_SECTOR_SIZE
+      || !dir_index_write_header (inode, &hdr))
+    goto done;
+
+  success = true;
+  for (size_t i = 0; i < length / sizeof *entries && success; i++)
+    if (entries[i].in_use)
+      success = dir_index_add (inode, &hdr, &entries[i]);
+done:
+  free (zeros);
+  free (entries);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -172,11 +492,15 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
+  struct dir_index_header hdr;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (dir_index_read_header (dir->inode, &hdr))
+    return dir_index_lookup (dir->inode, &hdr, name, ep, ofsp);
+
   // 以一个dir_entry的大小为步进, 逐个读取dir中的entry, 并比较文件名
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
@@ -191,6 +515,37 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+// 在扇区parent处的目录中查找name, 找到时将其inode的扇区号存入*SECTOR,
+// 是否为目录存入*IS_DIR
+// dentry cache未命中时才打开目录查找, 查找结果由dir_lookup()放入dentry cache
+static bool
+dir_lookup_sector (block_sector_t parent, const char *name,
+                   block_sector_t *sector, bool *is_dir)
+{
+  switch (dentry_lookup (parent, name, sector, is_dir))
+    {
+    case DENTRY_HIT:
+      return true;
+    case DENTRY_NEGATIVE:
+      return false;
+    default:
+      break;
+    }
+
+  struct dir *dir = dir_open (inode_open (parent));
+  struct inode *inode = NULL;
+  if (dir == NULL)
+    return false;
+  if (dir_lookup (dir, name, &inode))
+    {
+      *sector = inode_get_inumber (inode);
+      *is_dir = inode_is_dir (inode);
+    }
+  inode_close (inode);
+  dir_close (dir);
+  return inode != NULL;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -201,16 +556,39 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
+  block_sector_t parent, sector;
+  bool is_dir;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  parent = inode_get_inumber (dir->inode);
+  switch (dentry_lookup (parent, name, &sector, &is_dir))
+    {
+    case DENTRY_HIT:
+      *inode = inode_open (sector);
+      return *inode != NULL;
+    case DENTRY_NEGATIVE:
+      *inode = NULL;
+      return false;
+    default:
+      break;
+    }
+
+  rwlock_acquire_read (&dir_rwlock);
   if (lookup (dir, name, &e, NULL))
     // 打开的是dir_entry指向的文件的inode, 而非指向dir的inode!
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
 
+  // 记下查找结果, 找不到时记为negative entry
+  // 持有读锁时插入, 保证不会把被并发删除的名字重新放入dentry cache
+  if (*inode != NULL)
+    dentry_insert (parent, name, e.inode_sector, inode_is_dir (*inode));
+  else
+    dentry_insert (parent, name, 0, false);
+  rwlock_release_read (&dir_rwlock);
   return *inode != NULL;
 }
 
@@ -224,7 +602,8 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
-  off_t ofs;
+  struct dir_index_header hdr;
+  off_t ofs, free_ofs = -1;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -234,31 +613,61 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  rwlock_acquire_write (&dir_rwlock);
+  // 可能缓存了一个negative entry
+  dentry_invalidate (inode_get_inumber (dir->inode), name);
+
+  if (dir_index_read_header (dir->inode, &hdr))
+    {
+      if (dir_index_lookup (dir->inode, &hdr, name, NULL, NULL))
+        goto done;
+      goto add_indexed;
+    }
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  /* Check that NAME is not in use, and set FREE_OFS to offset of
+     the first free slot.  If there are no free slots, then it
+     will be set to the current end-of-file.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  // 将offset更新到下一个空闲的slot (尚未被使用的dir_entry空位)
+  // 只扫描一遍: 同时检查重名并记下第一个空闲的slot (尚未被使用的dir_entry空位)
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+    if (e.in_use && !strcmp (name, e.name))
+      goto done;
+    else if (!e.in_use && free_ofs < 0)
+      free_ofs = ofs;
+  if (free_ofs < 0)
+    {
+      // 线性格式的目录已满且足够大, 转换为索引格式
+      if (ofs / (off_t) sizeof e >= DIR_LINEAR_MAX)
+        {
+          if (!dir_index_convert (dir->inode)
+              || !dir_index_read_header (dir->inode, &hdr))
+            goto done;
+          goto add_indexed;
+        }
+      free_ofs = ofs;
+    }
 
   /* Write slot. */
   // 如果inode写入失败了, 怎么回收entry的数据?
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = inode_write_at (dir->inode, &e, sizeof e, free_ofs) == sizeof e;
+  goto done;
+
+ add_indexed:
+  memset (&e, 0, sizeof e);
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  success = dir_index_add (dir->inode, &hdr, &e);
 
  done:
+  rwlock_release_write (&dir_rwlock);
   return success;
 }
 
@@ -278,6 +687,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  rwlock_acquire_write (&dir_rwlock);
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -293,11 +703,17 @@ dir_remove (struct dir *dir, const char *name)
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  dentry_invalidate (inode_get_inumber (dir->inode), name);
+  // 被删除的目录的扇区可能被新目录重用, 以它为父目录的项必须全部失效
+  if (inode_is_dir (inode))
+    dentry_invalidate_dir (e.inode_sector);
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  rwlock_release_write (&dir_rwlock);
   inode_close (inode);
   return success;
 }
@@ -311,9 +727,30 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  struct dir_index_header hdr;
+  bool found = false;
+
+  rwlock_acquire_read (&dir_rwlock);
+  bool indexed = dir_index_read_header (dir->inode, &hdr);
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  // 索引格式的目录依次读取每个桶中的每个slot, 跳过头部和哈希表
+  if (indexed && dir->pos < dir_slot_ofs (0, 0))
+    dir->pos = dir_slot_ofs (0, 0);
+  for (;;)
     {
+      if (indexed)
+        {
+          uint32_t b = (dir->pos - dir_bucket_ofs (0)) / BLOCK_SECTOR_SIZE;
+          if (b >= hdr.bucket_cnt)
+            break;
+          if (dir->pos >= dir_slot_ofs (b, DIR_BUCKET_ENTRIES))
+            {
+              dir->pos = dir_slot_ofs (b + 1, 0);
+              continue;
+            }
+        }
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
@@ -321,10 +758,99 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
             continue;
 
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  rwlock_release_read (&dir_rwlock);
+  return found;
+}
+
+// 线性目录一次读取的目录项数
+#define DIR_BATCH_ENTRIES 64
+
+// 将目录项e转换为struct dirent, e未使用或者是"."和".."时返回false
+// 是否为目录优先从dentry cache中获取, 未命中时才打开e的inode
+static bool
+dir_fill_dirent (struct dir *dir, const struct dir_entry *e, struct dirent *d)
+{
+  block_sector_t parent = inode_get_inumber (dir->inode);
+  block_sector_t sector;
+  bool is_dir;
+
+  if (!e->in_use || !strcmp (e->name, ".") || !strcmp (e->name, ".."))
+    return false;
+
+  if (dentry_lookup (parent, e->name, &sector, &is_dir) != DENTRY_HIT
+      || sector != e->inode_sector)
+    {
+      struct inode *inode = inode_open (e->inode_sector);
+      is_dir = inode != NULL && inode_is_dir (inode);
+      inode_close (inode);
+      dentry_insert (parent, e->name, e->inode_sector, is_dir);
+    }
+
+  d->inumber = e->inode_sector;
+  d->is_dir = is_dir;
+  strlcpy (d->name, e->name, sizeof d->name);
+  return true;
+}
+
+// 从dir的当前位置开始读取至多cnt个目录项存入ents, 返回读取的目录项数, 0表示已经读完
+// 与dir_readdir()使用同一个位置, 但每次读取一整个桶(索引目录)
+// 或者DIR_BATCH_ENTRIES个目录项(线性目录), 而不是逐个读取
+size_t
+dir_readdir_batch (struct dir *dir, struct dirent *ents, size_t cnt)
+{
+  struct dir_index_header hdr;
+  size_t n = 0;
+
+  ASSERT (NAME_MAX == DIRENT_NAME_MAX);
+
+  rwlock_acquire_read (&dir_rwlock);
+  if (dir_index_read_header (dir->inode, &hdr))
+    {
+      struct dir_bucket *bucket = malloc (sizeof *bucket);
+      if (bucket == NULL)
+        goto done;
+      if (dir->pos < dir_slot_ofs (0, 0))
+        dir->pos = dir_slot_ofs (0, 0);
+      while (n < cnt)
+        {
+          uint32_t b = (dir->pos - dir_bucket_ofs (0)) / BLOCK_SECTOR_SIZE;
+          if (b >= hdr.bucket_cnt || !dir_bucket_read (dir->inode, b, bucket))
+            break;
+          size_t slot = (dir->pos - dir_slot_ofs (b, 0)) / sizeof (struct dir_entry);
+          for (; slot < DIR_BUCKET_ENTRIES && n < cnt; slot++)
+            if (dir_fill_dirent (dir, &bucket->entries[slot], &ents[n]))
+              n++;
+          dir->pos = slot < DIR_BUCKET_ENTRIES ? dir_slot_ofs (b, slot)
+                                               : dir_slot_ofs (b + 1, 0);
+        }
+      free (bucket);
+      goto done;
+    }
+
+  struct dir_entry *entries = malloc (DIR_BATCH_ENTRIES * sizeof *entries);
+  if (entries == NULL)
+    goto done;
+  while (n < cnt)
+    {
+      off_t bytes = inode_read_at (dir->inode, entries,
+                                   DIR_BATCH_ENTRIES * sizeof *entries, dir->pos);
+      size_t entry_cnt = bytes / sizeof *entries;
+      if (entry_cnt == 0)
+        break;
+      size_t i;
+      for (i = 0; i < entry_cnt && n < cnt; i++)
+        if (dir_fill_dirent (dir, &entries[i], &ents[n]))
+          n++;
+      dir->pos += i * sizeof *entries;
+    }
+  free (entries);
+ done:
+  rwlock_release_read (&dir_rwlock);
+  return n;
 }
 
 bool
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <dirent.h>
+#include "off_t.h"
 #include "../devices/block.h"
 
 /* Maximum length of a file name component.
@@ -13,6 +15,8 @@
 
 struct inode;
 
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, block_sector_t prev, const char *name, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -27,6 +31,9 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_batch (struct dir *, struct dirent *, size_t cnt);
+void dir_seek (struct dir *, off_t);
+off_t dir_tell (const struct dir *);
 bool dir_is_empty(struct dir *dir);
 
 #endif /* filesys/directory.h */
@@ -3,16 +3,17 @@
 #include <stdio.h>
 #include <string.h>
 #include "cache.h"
+#include "dentry.h"
 #include "file.h"
 #include "free-map.h"
 #include "inode.h"
 #include "directory.h"
+#include "journal.h"
 #include "../threads/synch.h"
 
 /* Partition that contains the file system. */
 // 指向存有filesystem的块设备
 struct block *fs_device;
-struct lock filesys_lock;
 
 static void do_format (void);
 
@@ -25,14 +26,18 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
-  lock_init(&filesys_lock);
+  // cache的写回线程会写回free map, 因此free map要先初始化
+  free_map_init ();
   cache_init();
+  dentry_init();
   inode_init ();
-  free_map_init ();
+  dir_init ();
 
   if (format) 
     do_format ();
 
+  // 重放日志必须在读取free map和任何元数据之前完成
+  journal_init (format);
   free_map_open ();
 }
 
@@ -42,6 +47,13 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  // 测试日志重放: 只提交日志, 不写回任何其他内容, 相当于断电
+  if (journal_crash_on_shutdown)
+    {
+      journal_crash ();
+      return;
+    }
+  journal_commit ();
   cache_writeback_all();
   free_map_close ();
 }
@@ -55,6 +67,7 @@ bool
 filesys_create (block_sector_t dir_sector, const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
+  journal_begin ();
   struct dir *dir = dir_open(inode_open(dir_sector));
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
@@ -63,6 +76,7 @@ filesys_create (block_sector_t dir_sector, const char *name, off_t initial_size)
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -92,9 +106,11 @@ filesys_open (block_sector_t dir_sector, const char *name)
 bool
 filesys_remove (block_sector_t dir_sector, const char *name) 
 {
+  journal_begin ();
   struct dir *dir = dir_open(inode_open(dir_sector));
   bool success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
@@ -9,10 +9,12 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define FREE_MAP_LOG_SECTOR 2   /* free map的intent log, 见free-map.c */
+#define JOURNAL_SECTOR 3        /* 元数据日志区的第一个扇区, 见journal.c */
+#define JOURNAL_SECTORS 64      /* 日志区占用的扇区数 */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
-extern struct lock filesys_lock;
 
 void filesys_init (bool format);
 void filesys_done (void);
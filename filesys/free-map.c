@@ -1,9 +1,15 @@
 #include "free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include "cache.h"
 #include "file.h"
 #include "filesys.h"
 #include "inode.h"
+#include "../threads/malloc.h"
+#include "../threads/synch.h"
 
 // 使用bitmap记录磁盘上空闲的扇区
 // free_map_file内存储了bitmap
@@ -11,9 +17,58 @@ static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 // 每个扇区对应一个bit!
 
+// 分配和释放只修改内存中的bitmap, 并记下被修改的是free_map_file的哪几个扇区
+// 修改过的扇区由cache的写回线程调用free_map_flush()批量写回
+// 每次分配/释放都追加到内存中的intent log, 写回时先把log写入磁盘, 再写回bitmap的各个扇区
+// bitmap写到一半时崩溃, 挂载时重放intent log即可修复, 再写回bitmap并清空log
+// 分配和释放本身不进行任何I/O, 两次写回之间的修改在崩溃后丢失, 与同样由写回线程写回的元数据一致
+// 开启元数据日志后不再使用intent log和写回线程: bitmap被修改的扇区在每次提交时写入cache,
+// 与引用这些扇区的元数据属于同一个事务(见free_map_journal_prepare()), 未提交的分配在崩溃后自然消失
+static struct bitmap *free_map_dirty; // free_map_file中的每个扇区对应一个bit
+static struct lock free_map_lock;
+
+#define FREE_MAP_LOG_MAGIC 0x474f4c46  // "FLOG"
+
+// intent log中的一条记录, cnt > 0表示分配了从start开始的cnt个扇区, cnt < 0表示释放
+struct free_map_log_entry
+{
+  block_sector_t start;
+  int32_t cnt;
+};
+
+#define FREE_MAP_LOG_ENTRIES \
+  ((BLOCK_SECTOR_SIZE - 2 * sizeof(uint32_t)) / sizeof(struct free_map_log_entry))
+
+// 存放在FREE_MAP_LOG_SECTOR中的intent log, 不经过cache直接读写
+struct free_map_log
+{
+  uint32_t magic;
+  uint32_t cnt;
+  struct free_map_log_entry entries[FREE_MAP_LOG_ENTRIES];
+};
+
+static struct free_map_log *free_map_log;
+
+// 开启元数据日志后, 释放的扇区先记在这里, 提交时才在bitmap中释放, 与释放它们的元数据修改一起提交
+// 否则崩溃后未提交的旧元数据可能仍然指向已经被重新分配的扇区
+struct free_map_deferred
+{
+  block_sector_t start;
+  size_t cnt;
+  struct list_elem elem;
+};
+
+static bool free_map_journaled;
+static struct list free_map_deferred_list;
+// 开启元数据日志后, 上次提交以来新分配的扇区, 每个扇区对应一个bit
+// 提交前先把其中的文件数据写回, 已提交的元数据不会指向还保存着被删除文件旧数据的扇区
+static struct bitmap *free_map_fresh;
+
+static void free_map_flush_locked (void);
+
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
   // block_size返回device有多少个扇区
   free_map = bitmap_create (block_size (fs_device));
@@ -22,66 +77,303 @@ free_map_init (void)
   // bitmap_mark()将bitmap中的某一位设置为true(1)
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, FREE_MAP_LOG_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  free_map_fresh = bitmap_create (block_size (fs_device));
+  free_map_log = calloc (1, sizeof *free_map_log);
+  if (free_map_dirty == NULL || free_map_fresh == NULL || free_map_log == NULL)
+    PANIC ("free map initialization failed");
+  ASSERT (sizeof *free_map_log == BLOCK_SECTOR_SIZE);
+  lock_init (&free_map_lock);
+  list_init (&free_map_deferred_list);
+}
+
+// 将bitmap中从sector开始的cnt位所在的free_map_file扇区标记为脏
+static void
+free_map_mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / 8 / BLOCK_SECTOR_SIZE;
+  size_t last = (sector + cnt - 1) / 8 / BLOCK_SECTOR_SIZE;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+// 将一次分配(cnt > 0)或释放(cnt < 0)追加到内存中的intent log, 由free_map_flush()写入磁盘
+// log已满时先写回bitmap, 清空log
+// 调用者必须持有free_map_lock, 且已经修改了内存中的bitmap
+static void
+free_map_log_append (block_sector_t sector, int32_t cnt)
+{
+  // 格式化过程中free_map_file尚未打开, bitmap会在free_map_close()时整体写回
+  if (free_map_file == NULL || free_map_journaled)
+    return;
+  if (free_map_log->cnt == FREE_MAP_LOG_ENTRIES)
+    free_map_flush_locked ();
+  free_map_log->entries[free_map_log->cnt].start = sector;
+  free_map_log->entries[free_map_log->cnt].cnt = cnt;
+  free_map_log->cnt++;
+}
+
+// 记录一次已经在bitmap中完成的分配
+// 调用者必须持有free_map_lock
+static void
+free_map_commit (block_sector_t sector, size_t cnt)
+{
+  free_map_mark_dirty (sector, cnt);
+  if (free_map_journaled)
+    bitmap_set_multiple (free_map_fresh, sector, cnt, true);
+  free_map_log_append (sector, (int32_t) cnt);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
+  lock_acquire (&free_map_lock);
   block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  // 这三条条件中任意一条不满足都会触发allocate失败!
-  // 利用了&&运算符"短路"的特性! 条件判断的顺序非常重要! 不能更改!
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      free_map_commit (sector, cnt);
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+// 从start开始分配尽可能多(不超过cnt个)的连续空闲扇区, 返回分配的扇区数
+// 用于在文件最后一个extent之后原地延长
+size_t
+free_map_allocate_at (block_sector_t start, size_t cnt)
+{
+  size_t n = 0;
+
+  lock_acquire (&free_map_lock);
+  while (n < cnt && start + n < bitmap_size (free_map)
+         && !bitmap_test (free_map, start + n))
+    n++;
+  if (n > 0)
+    {
+      bitmap_set_multiple (free_map, start, n, true);
+      free_map_commit (start, n);
+    }
+  lock_release (&free_map_lock);
+  return n;
+}
+
+// 分配一段不超过cnt个扇区的连续空间, 起始扇区存入*SECTORP, 返回分配的扇区数
+// 找不到cnt个连续扇区时, 依次尝试一半大小的空间, 没有任何空闲扇区时返回0
+size_t
+free_map_allocate_run (size_t cnt, block_sector_t *sectorp)
+{
+  lock_acquire (&free_map_lock);
+  for (; cnt > 0; cnt /= 2)
+    {
+      block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+      if (sector != BITMAP_ERROR)
+        {
+          free_map_commit (sector, cnt);
+          *sectorp = sector;
+          break;
+        }
+    }
+  lock_release (&free_map_lock);
+  return cnt;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 // 将已经使用的sector对应的bits设置为false
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  struct free_map_deferred *d;
+
+  lock_acquire (&free_map_lock);
   // bitmap_all()检测从sector开始cnt个sector是否都被设为true
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  // 内存不足时只能立即释放
+  if (free_map_journaled && (d = malloc (sizeof *d)) != NULL)
+    {
+      d->start = sector;
+      d->cnt = cnt;
+      list_push_back (&free_map_deferred_list, &d->elem);
+    }
+  else
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      free_map_mark_dirty (sector, cnt);
+      free_map_log_append (sector, -(int32_t) cnt);
+    }
+  lock_release (&free_map_lock);
+}
+
+// 设置free map是否随元数据日志一起提交, 由journal_init()开启
+void
+free_map_use_journal (bool journaled)
+{
+  free_map_journaled = journaled;
+}
+
+// 由journal_commit()在阻止了新的handle之后, 写入事务之前调用:
+// 1. 把上次提交以来新分配的扇区中的文件数据写回磁盘, 保证数据先于指向它的元数据落盘
+// 2. 在bitmap中释放被推迟的扇区, 把bitmap被修改过的扇区写入cache, 它们成为事务的一部分
+// 提交完成之前没有handle可以分配扇区, 被释放的扇区不会在提交前被重新使用
+void
+free_map_journal_prepare (void)
+{
+  // 挂载过程中写回线程可能在free_map_open()之前提交
+  if (free_map_file == NULL)
+    return;
+
+  lock_acquire (&free_map_lock);
+  size_t sector = 0;
+  while ((sector = bitmap_scan (free_map_fresh, sector, 1, true)) != BITMAP_ERROR)
+    {
+      // 元数据扇区属于事务, cache_sync()不会提前写回它们
+      cache_sync (sector);
+      bitmap_reset (free_map_fresh, sector);
+    }
+
+  while (!list_empty (&free_map_deferred_list))
+    {
+      struct free_map_deferred *d =
+        list_entry (list_pop_front (&free_map_deferred_list),
+                    struct free_map_deferred, elem);
+      bitmap_set_multiple (free_map, d->start, d->cnt, false);
+      free_map_mark_dirty (d->start, d->cnt);
+      free (d);
+    }
+
+  enum block_io_class old = block_set_io_class (BLOCK_IO_FREE_MAP);
+  for (size_t i = 0; i < bitmap_size (free_map_dirty); i++)
+    {
+      if (!bitmap_test (free_map_dirty, i))
+        continue;
+      off_t ofs = i * BLOCK_SECTOR_SIZE;
+      if (!bitmap_write_part (free_map, free_map_file, ofs, BLOCK_SECTOR_SIZE))
+        PANIC ("can't write free map");
+      bitmap_reset (free_map_dirty, i);
+    }
+  block_set_io_class (old);
+  lock_release (&free_map_lock);
+}
+
+// 先将intent log写入磁盘, 再将被修改过的bitmap扇区写入free_map_file并立即写回磁盘, 随后清空log
+// 必须先保证bitmap已经落盘, 才能清空log
+// 调用者必须持有free_map_lock
+static void
+free_map_flush_locked (void)
+{
+  if (free_map_file == NULL)
+    return;
+
+  // 经过cache写回的free_map_file扇区也按free map统计
+  enum block_io_class old = block_set_io_class (BLOCK_IO_FREE_MAP);
+  if (free_map_log->cnt > 0)
+    block_write (fs_device, FREE_MAP_LOG_SECTOR, free_map_log);
+
+  struct inode *inode = file_get_inode (free_map_file);
+  for (size_t i = 0; i < bitmap_size (free_map_dirty); i++)
+    {
+      if (!bitmap_test (free_map_dirty, i))
+        continue;
+      off_t ofs = i * BLOCK_SECTOR_SIZE;
+      if (!bitmap_write_part (free_map, free_map_file, ofs, BLOCK_SECTOR_SIZE))
+        PANIC ("can't write free map");
+      cache_sync (byte_to_sector (inode, ofs));
+      bitmap_reset (free_map_dirty, i);
+    }
+
+  if (free_map_log->cnt > 0)
+    {
+      free_map_log->cnt = 0;
+      block_write (fs_device, FREE_MAP_LOG_SECTOR, free_map_log);
+    }
+  block_set_io_class (old);
+}
+
+// 写回内存中被修改过的free map, 由cache的写回线程定期调用
+// 开启日志后free map随事务提交, 这里什么也不做
+void
+free_map_flush (void)
+{
+  if (free_map_journaled)
+    return;
+  lock_acquire (&free_map_lock);
+  free_map_flush_locked ();
+  lock_release (&free_map_lock);
+}
+
+// 重放intent log中记录的, 崩溃前尚未写回的分配和释放
+static void
+free_map_replay (void)
+{
+  enum block_io_class old = block_set_io_class (BLOCK_IO_FREE_MAP);
+  block_read (fs_device, FREE_MAP_LOG_SECTOR, free_map_log);
+  block_set_io_class (old);
+  if (free_map_log->magic != FREE_MAP_LOG_MAGIC
+      || free_map_log->cnt > FREE_MAP_LOG_ENTRIES)
+    {
+      // 没有有效的log, 可能是旧格式的磁盘
+      free_map_log->magic = FREE_MAP_LOG_MAGIC;
+      free_map_log->cnt = 0;
+      block_write (fs_device, FREE_MAP_LOG_SECTOR, free_map_log);
+      return;
+    }
+  // 开启日志时bitmap已经由日志重放恢复到最后一次提交的状态
+  // log中的记录只可能来自没有提交的事务, 丢弃它们, 否则这些扇区会被永久占用
+  if (free_map_journaled)
+    {
+      if (free_map_log->cnt > 0)
+        {
+          free_map_log->cnt = 0;
+          block_write (fs_device, FREE_MAP_LOG_SECTOR, free_map_log);
+        }
+      return;
+    }
+
+  for (uint32_t i = 0; i < free_map_log->cnt; i++)
+    {
+      struct free_map_log_entry *e = &free_map_log->entries[i];
+      size_t cnt = e->cnt > 0 ? (size_t) e->cnt : (size_t) -e->cnt;
+      bitmap_set_multiple (free_map, e->start, cnt, e->cnt > 0);
+      free_map_mark_dirty (e->start, cnt);
+    }
+  free_map_flush_locked ();
 }
 
 /* Opens the free map file and reads it from disk. */
 // 从文件中读取free_map的bitmap
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  lock_acquire (&free_map_lock);
+  free_map_replay ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
-// TODO: 这哪来的写回数据???
 void
-free_map_close (void) 
+free_map_close (void)
 {
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
@@ -93,4 +385,9 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+
+  /* Start with an empty intent log. */
+  free_map_log->magic = FREE_MAP_LOG_MAGIC;
+  free_map_log->cnt = 0;
+  block_write (fs_device, FREE_MAP_LOG_SECTOR, free_map_log);
 }
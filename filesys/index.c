@@ -12,26 +12,53 @@
 #include <stdlib.h>
 #include <string.h>
 
-// 每个间接块可容纳的指针数
-#define INDIRECT_PER_BLOCK   (BLOCK_SECTOR_SIZE / sizeof(block_sector_t)) 
-#define MAX_FILE_SECTORS     (DIRECT_BLOCKS + INDIRECT_PER_BLOCK + (INDIRECT_PER_BLOCK * INDIRECT_PER_BLOCK))
+// 每个间接extent块可容纳的extent数
+#define EXTENTS_PER_BLOCK ((BLOCK_SECTOR_SIZE - 2 * sizeof(uint32_t)) / sizeof(struct inode_extent))
+
+// 间接extent块, inode中放不下的extent依次存放在由这些块组成的单向链表中
+struct index_extent_block
+{
+  block_sector_t next;                              // 下一个间接extent块, 0表示没有
+  uint32_t cnt;                                     // 本块中已使用的extent数
+  struct inode_extent extents[EXTENTS_PER_BLOCK];
+};
+
 // 用于填充0的辅助内存空间
 char zeros[BLOCK_SECTOR_SIZE];
 
 void
 index_init()
 {
+  ASSERT(sizeof(struct index_extent_block) == BLOCK_SECTOR_SIZE);
   memset(zeros, 0, BLOCK_SECTOR_SIZE);
 }
 
 
+// 读写间接extent块的cache_get()/cache_put(), 这些扇区按元数据统计I/O
+static struct index_extent_block *
+index_block_get(block_sector_t block, bool write)
+{
+  enum block_io_class old = block_set_io_class(BLOCK_IO_META);
+  struct index_extent_block *eb = cache_get(block, write);
+  block_set_io_class(old);
+  return eb;
+}
+
+static void
+index_block_put(block_sector_t block, bool dirty)
+{
+  enum block_io_class old = block_set_io_class(BLOCK_IO_META);
+  cache_put(block, dirty);
+  block_set_io_class(old);
+}
+
 // 在freemap中分配一个空白的sector, 并且向里面填充0, 同时修改sector指向的内存
 bool
 index_allocate_single_sector(block_sector_t *sector)
 {
   if (free_map_allocate(1, sector))
   {
-    cache_write(*sector, zeros, false);
+    cache_write(*sector, zeros);
     return true;
   }
   else 
@@ -40,186 +67,352 @@ index_allocate_single_sector(block_sector_t *sector)
   }
 }
 
-// 返回length位置在当前文件的间接块树中的索引
-// 比如, 假设length = 18499238, 返回level = 2, idx1 = 103, idx2 = 48(这是随口说的, 不准确)
-// 说明文件的第18499238个字节所在的扇区地址位于
-// 第二级间接块第103条目对应的第一级间接块中的第48个条目锁存储的扇区号
-void
-index_where_the_sector(off_t length, uint8_t *level, uint8_t *idx1, uint8_t *idx2)
+// 找到文件中第sector_idx个扇区所在的extent, 返回extent的序号, 并把扇区在extent中的偏移存入*ofs
+// 超出extent覆盖的范围时返回data->extent_cnt
+static uint32_t
+index_find(const struct inode_disk *data, uint32_t sector_idx, uint32_t *ofs)
 {
-  uint32_t sectors = length / BLOCK_SECTOR_SIZE; 
+  if (sector_idx >= data->sector_cnt)
+    return data->extent_cnt;
 
-  if (sectors >= MAX_FILE_SECTORS)
-    PANIC("Too long File!\n");
+  uint32_t direct_cnt = data->extent_cnt < INODE_DIRECT_EXTENTS ? data->extent_cnt : INODE_DIRECT_EXTENTS;
+  for (uint32_t i = 0; i < direct_cnt; i++)
+  {
+    if (sector_idx < data->extents[i].length)
+    {
+      *ofs = sector_idx;
+      return i;
+    }
+    sector_idx -= data->extents[i].length;
+  }
 
-  if (sectors < DIRECT_BLOCKS)
+  // 在间接extent块链表中继续查找, 直接读取cache中的内容
+  uint32_t idx = INODE_DIRECT_EXTENTS;
+  block_sector_t block = data->extent_block;
+  while (block != 0)
   {
-    *level = 0;
-    *idx1 = sectors;
-    *idx2 = 255;
-    return ;
+    struct index_extent_block *eb = index_block_get(block, false);
+    for (uint32_t i = 0; i < eb->cnt; i++, idx++)
+    {
+      if (sector_idx < eb->extents[i].length)
+      {
+        index_block_put(block, false);
+        *ofs = sector_idx;
+        return idx;
+      }
+      sector_idx -= eb->extents[i].length;
+    }
+    block_sector_t next = eb->next;
+    index_block_put(block, false);
+    block = next;
   }
-  sectors -= DIRECT_BLOCKS;
-  if (sectors >= INDIRECT_PER_BLOCK)
+  return data->extent_cnt;
+}
+
+// 返回第idx个extent所在的间接extent块, 以及它在块中的位置
+// 除最后一块外每个间接extent块都是满的, 所以可以直接按序号计算
+static block_sector_t
+index_locate(const struct inode_disk *data, uint32_t idx, uint32_t *slot)
+{
+  ASSERT(idx >= INODE_DIRECT_EXTENTS);
+  idx -= INODE_DIRECT_EXTENTS;
+  block_sector_t block = data->extent_block;
+  while (idx >= EXTENTS_PER_BLOCK)
   {
-    ASSERT(sectors > 0);
-    sectors -= INDIRECT_PER_BLOCK;
-    *level = 2;
-    *idx1 = sectors / INDIRECT_PER_BLOCK;
-    *idx2 = sectors % INDIRECT_PER_BLOCK;
-    return ;
+    struct index_extent_block *eb = index_block_get(block, false);
+    block_sector_t next = eb->next;
+    index_block_put(block, false);
+    block = next;
+    idx -= EXTENTS_PER_BLOCK;
   }
-  else
+  *slot = idx;
+  return block;
+}
+
+// 读取第idx个extent
+static struct inode_extent
+index_read(const struct inode_disk *data, uint32_t idx)
+{
+  ASSERT(idx < data->extent_cnt);
+  if (idx < INODE_DIRECT_EXTENTS)
+    return data->extents[idx];
+
+  uint32_t slot;
+  block_sector_t block = index_locate(data, idx, &slot);
+  struct index_extent_block *eb = index_block_get(block, false);
+  struct inode_extent ext = eb->extents[slot];
+  index_block_put(block, false);
+  return ext;
+}
+
+// 修改第idx个extent
+static void
+index_write(struct inode_disk *data, uint32_t idx, struct inode_extent ext)
+{
+  ASSERT(idx < data->extent_cnt);
+  if (idx < INODE_DIRECT_EXTENTS)
   {
-    *level = 1;
-    *idx1 = sectors;
-    *idx2 = 255;
+    data->extents[idx] = ext;
     return ;
   }
+
+  uint32_t slot;
+  block_sector_t block = index_locate(data, idx, &slot);
+  struct index_extent_block *eb = index_block_get(block, true);
+  eb->extents[slot] = ext;
+  index_block_put(block, true);
 }
 
-// 延长文件
-bool
-index_extend(struct inode_disk *data, off_t new_length) 
+// 返回文件中第sector_idx个扇区所在的磁盘扇区号
+// 位于空洞中或超出extent覆盖的范围时返回0
+// data是inode在内存中的元数据
+block_sector_t
+index_lookup(const struct inode_disk *data, uint32_t sector_idx)
 {
-  off_t now_length = data->length;
+  uint32_t ofs;
+  uint32_t idx = index_find(data, sector_idx, &ofs);
+  if (idx == data->extent_cnt)
+    return 0;
+  struct inode_extent ext = index_read(data, idx);
+  return ext.start == 0 ? 0 : ext.start + ofs;
+}
 
-  // 计算现有和需要的扇区数目
-  size_t existing_sectors = DIV_ROUND_UP(now_length, BLOCK_SECTOR_SIZE);
-  size_t new_sectors = DIV_ROUND_UP(new_length, BLOCK_SECTOR_SIZE);
-  int delta = new_sectors - existing_sectors;
+// 返回链表中最后一个间接extent块, 没有间接extent块时返回0
+// 若prev不为NULL, 把倒数第二个间接extent块存入*prev(不存在时为0)
+static block_sector_t
+index_last_block(const struct inode_disk *data, block_sector_t *prev)
+{
+  block_sector_t before = 0;
+  block_sector_t block = data->extent_block;
+  while (block != 0)
+  {
+    struct index_extent_block *eb = index_block_get(block, false);
+    block_sector_t next = eb->next;
+    index_block_put(block, false);
+    if (next == 0)
+      break;
+    before = block;
+    block = next;
+  }
+  if (prev != NULL)
+    *prev = before;
+  return block;
+}
 
-  // 不需要新分配扇区的情况
-  if (delta <= 0) {
-      data->length = new_length;
-      return true;
+// 在最后追加一个extent, 必要时分配新的间接extent块
+static bool
+index_push(struct inode_disk *data, struct inode_extent ext)
+{
+  struct index_extent_block *eb;
+
+  if (data->extent_cnt < INODE_DIRECT_EXTENTS)
+  {
+    data->extents[data->extent_cnt++] = ext;
+    return true;
   }
 
-  for (int i = 0; i < delta; i++)
+  // inode中的extent已满, 追加到最后一个间接extent块中
+  block_sector_t block = index_last_block(data, NULL);
+  if (block != 0)
   {
-    size_t sector_num = existing_sectors + i;
-    uint8_t level, idx1, idx2;
-    // 计算当前扇区号对应的索引位置
-    index_where_the_sector(sector_num * BLOCK_SECTOR_SIZE, &level, &idx1, &idx2);
-    // 处理新的sector
-    if (level == 0)
-    {
-      ASSERT(data->direct[idx1] == 0);
-      index_allocate_single_sector(&data->direct[idx1]);
-    }
-    else if (level == 1)
+    eb = index_block_get(block, true);
+    if (eb->cnt < EXTENTS_PER_BLOCK)
     {
-      // 如果尚未分配第一级间接块目录
-      if (data->indirect == 0)
-        index_allocate_single_sector(&data->indirect);
-      // 读取第一级间接块目录
-      block_sector_t *table = calloc(1, BLOCK_SECTOR_SIZE);
-      ASSERT(table != NULL);
-      cache_read(data->indirect, table, false);
-
-      ASSERT(table[idx1] == 0);
-      index_allocate_single_sector(&(table[idx1]));
-      // 将修改后的table写入磁盘
-      cache_write(data->indirect, table, false);
-      free(table);
+      eb->extents[eb->cnt++] = ext;
+      data->extent_cnt++;
+      index_block_put(block, true);
+      return true;
     }
-    else if (level == 2)
+    index_block_put(block, false);
+  }
+
+  // 最后一个间接extent块也满了(或者还没有), 分配一个新的块并接到链表末尾
+  block_sector_t new_block;
+  if (!index_allocate_single_sector(&new_block))
+    return false;
+  eb = index_block_get(new_block, true);
+  eb->extents[0] = ext;
+  eb->cnt = 1;
+  index_block_put(new_block, true);
+
+  if (block == 0)
+    data->extent_block = new_block;
+  else
+  {
+    eb = index_block_get(block, true);
+    eb->next = new_block;
+    index_block_put(block, true);
+  }
+  data->extent_cnt++;
+  return true;
+}
+
+// 去掉最后一个extent, 最后一个间接extent块空了时将其释放
+static void
+index_pop(struct inode_disk *data)
+{
+  ASSERT(data->extent_cnt > 0);
+  data->extent_cnt--;
+  if (data->extent_cnt < INODE_DIRECT_EXTENTS)
+    return ;
+
+  block_sector_t prev;
+  block_sector_t block = index_last_block(data, &prev);
+  struct index_extent_block *eb = index_block_get(block, true);
+  bool empty = --eb->cnt == 0;
+  index_block_put(block, !empty);
+  if (!empty)
+    return ;
+
+  if (prev == 0)
+    data->extent_block = 0;
+  else
+  {
+    eb = index_block_get(prev, true);
+    eb->next = 0;
+    index_block_put(prev, true);
+  }
+  free_map_release(block, 1);
+}
+
+// 在第idx个位置插入一个extent, 之后的extent依次后移
+static bool
+index_insert(struct inode_disk *data, uint32_t idx, struct inode_extent ext)
+{
+  uint32_t cnt = data->extent_cnt;
+  if (idx == cnt)
+    return index_push(data, ext);
+  if (!index_push(data, index_read(data, cnt - 1)))
+    return false;
+  for (uint32_t i = cnt - 1; i > idx; i--)
+    index_write(data, i, index_read(data, i - 1));
+  index_write(data, idx, ext);
+  return true;
+}
+
+// 删除第idx个extent, 之后的extent依次前移
+static void
+index_delete(struct inode_disk *data, uint32_t idx)
+{
+  for (uint32_t i = idx; i + 1 < data->extent_cnt; i++)
+    index_write(data, i, index_read(data, i + 1));
+  index_pop(data);
+}
+
+// 延长文件, 新增的部分只是一个空洞, 不分配也不填充任何扇区
+// 空洞与最后一个空洞extent相邻时直接延长它
+bool
+index_extend(struct inode_disk *data, off_t new_length) 
+{
+  size_t new_sectors = DIV_ROUND_UP(new_length, BLOCK_SECTOR_SIZE);
+
+  if (data->sector_cnt < new_sectors)
+  {
+    struct inode_extent hole = { 0, new_sectors - data->sector_cnt };
+    if (data->extent_cnt > 0)
     {
-      // 如果尚未分配第二级间接块目录
-      if (data->double_indirect == 0)
-        index_allocate_single_sector(&data->double_indirect);
-      // 读取第二级间接块目录
-      block_sector_t *table2 = calloc(1, BLOCK_SECTOR_SIZE);
-      ASSERT(table2 != NULL);
-      cache_read(data->double_indirect, table2, false);
-
-      // 如果尚未分配第一级间接块目录, 并将修改后的table2写入磁盘
-      if (table2[idx1] == 0)
+      struct inode_extent last = index_read(data, data->extent_cnt - 1);
+      if (last.start == 0)
       {
-        index_allocate_single_sector(&(table2[idx1]));
-        cache_write(data->double_indirect, table2, false);
+        last.length += hole.length;
+        index_write(data, data->extent_cnt - 1, last);
       }
-      // 获取一级间接块的扇区编号
-      block_sector_t table1_sector = table2[idx1];
-
-      // 分配第一级间接块的内存空间
-      block_sector_t *table1 = calloc(1, BLOCK_SECTOR_SIZE);
-      ASSERT(table1 != NULL);
-      
-      // 读取第一级间接块目录
-      ASSERT(table1_sector != 0);
-      cache_read(table1_sector, table1, false);
-      // 确保idx2指向的位置尚未被分配
-      ASSERT(table1[idx2] == 0);
-      // 分配存储文件的sector
-      index_allocate_single_sector(&(table1[idx2]));
-      // 将修改后的table1写入磁盘
-      cache_write(table1_sector, table1, false);
-      free(table2);
-      free(table1);
-    }
-    else {
-      PANIC("Unknown level!");
+      else if (!index_push(data, hole))
+        return false;
     }
-    now_length += BLOCK_SECTOR_SIZE;
-  }    
+    else if (!index_push(data, hole))
+      return false;
+    data->sector_cnt = new_sectors;
+  }
   //更新文件的长度
-  data->length = new_length;
+  if (new_length > data->length)
+    data->length = new_length;
   return true;
 }
 
-// 释放文件持有的所有sector
-void
-index_relese_sectors(struct inode_disk *data)
+// 为空洞中从第sector_idx个扇区开始的至多cnt个扇区分配磁盘空间, 不会越过空洞的末尾
+// 起始扇区号存入*sector, 返回分配的扇区数, 磁盘空间不足时返回0
+// 新分配的扇区不会被填充, 由调用者决定是整个写入还是先填充为0
+// 优先紧接着前一个extent原地延长, 其次分配一段同样大小的连续空间, 空间不足时才拆成更小的段
+// 这样顺序写入的文件在磁盘上也是连续的, 且每段只需写一次free map
+size_t
+index_fill(struct inode_disk *data, uint32_t sector_idx, size_t cnt, block_sector_t *sector)
 {
-  // 释放直接块
-  for (int i = 0; i < DIRECT_BLOCKS && data->direct[i] != 0; i++)
-    free_map_release(data->direct[i], 1);
+  uint32_t ofs;
+  uint32_t idx = index_find(data, sector_idx, &ofs);
+  ASSERT(idx < data->extent_cnt);
+  struct inode_extent hole = index_read(data, idx);
+  ASSERT(hole.start == 0);
+  if (cnt > hole.length - ofs)
+    cnt = hole.length - ofs;
 
-  // 下面释放间接块
-  // 如果文件压根没用到第一级间接块
-  if (data->indirect == 0)
-    return ;
-  // 读取第一级间接块
-  block_sector_t *indirect_table = calloc(1, BLOCK_SECTOR_SIZE);
-  ASSERT(indirect_table != NULL);
-  cache_read(data->indirect, indirect_table, true);
-
-  // 释放第一级间接块指向的所有扇区
-  for (int i = 0; i < INDIRECT_PER_BLOCK && indirect_table[i] != 0; i++)
-    free_map_release(indirect_table[i], 1);
-
-  free(indirect_table);
-  //释放第一级间接块本身
-  free_map_release(data->indirect, 1);
-
-  // 释放第二级间接块
-  // 如果文件压根没用到第二级间接块
-  if (data->double_indirect == 0)
-    return ;
+  // 空洞的开头紧接着一个数据extent, 尝试原地延长它
+  if (ofs == 0 && idx > 0)
+  {
+    struct inode_extent prev = index_read(data, idx - 1);
+    ASSERT(prev.start != 0);
+    size_t got = free_map_allocate_at(prev.start + prev.length, cnt);
+    if (got > 0)
+    {
+      *sector = prev.start + prev.length;
+      prev.length += got;
+      index_write(data, idx - 1, prev);
+      hole.length -= got;
+      if (hole.length == 0)
+        index_delete(data, idx);
+      else
+        index_write(data, idx, hole);
+      return got;
+    }
+  }
+
+  size_t got = free_map_allocate_run(cnt, sector);
+  if (got == 0)
+    return 0;
+
+  // 把空洞拆成 [前半部分空洞] [新分配的扇区] [后半部分空洞], 空的部分省略
+  struct inode_extent pieces[3];
+  int n = 0;
+  if (ofs > 0)
+    pieces[n++] = (struct inode_extent) { 0, ofs };
+  pieces[n++] = (struct inode_extent) { *sector, got };
+  if (hole.length - ofs - got > 0)
+    pieces[n++] = (struct inode_extent) { 0, hole.length - ofs - got };
+
+  // 先插入新增的extent, 失败时(间接extent块分配失败)撤销已插入的部分
+  for (int i = 1; i < n; i++)
+    if (!index_insert(data, idx + i, pieces[i]))
+    {
+      while (--i > 0)
+        index_delete(data, idx + i);
+      free_map_release(*sector, got);
+      return 0;
+    }
+  index_write(data, idx, pieces[0]);
+  return got;
+}
 
-  block_sector_t *double_indirect_table = calloc(1, BLOCK_SECTOR_SIZE);
-  ASSERT(double_indirect_table != NULL);
-  cache_read(data->double_indirect, double_indirect_table, false);
+// 释放文件持有的所有sector, 空洞没有占用任何扇区
+void
+index_relese_sectors(struct inode_disk *data)
+{
+  // 释放inode中的extent
+  uint32_t direct_cnt = data->extent_cnt < INODE_DIRECT_EXTENTS ? data->extent_cnt : INODE_DIRECT_EXTENTS;
+  for (uint32_t i = 0; i < direct_cnt; i++)
+    if (data->extents[i].start != 0)
+      free_map_release(data->extents[i].start, data->extents[i].length);
 
-  // 遍历第二级间接块内指向的所有第一级间接块
-  for (int i = 0; i < INDIRECT_PER_BLOCK && double_indirect_table[i] != 0; i++)
+  // 释放间接extent块中的extent, 以及间接extent块本身
+  block_sector_t block = data->extent_block;
+  while (block != 0)
   {
-    // 读取指向的第一级间接块
-    block_sector_t *table1 = calloc(1, BLOCK_SECTOR_SIZE);
-    ASSERT(table1 != NULL);
-    cache_read(double_indirect_table[i], table1, false);
-
-    // 释放第一级间接块指向的所有扇区
-    for (int j = 0; j < INDIRECT_PER_BLOCK && table1[j] != 0; j++)
-      free_map_release(table1[j], 1);
-
-    free(table1);
-    // 释放第一级间接块本身
-    free_map_release(double_indirect_table[i], 1);
+    struct index_extent_block *eb = index_block_get(block, false);
+    for (uint32_t i = 0; i < eb->cnt; i++)
+      if (eb->extents[i].start != 0)
+        free_map_release(eb->extents[i].start, eb->extents[i].length);
+    block_sector_t next = eb->next;
+    index_block_put(block, false);
+    free_map_release(block, 1);
+    block = next;
   }
-
-  free(double_indirect_table);
-  // 释放第二级间接块本身
-  free_map_release(data->double_indirect, 1);
 }
@@ -4,9 +4,13 @@
 #include "inode.h"
 #include "off_t.h"
 
+// 全为0的扇区, 用于填充新分配的扇区
+extern char zeros[BLOCK_SECTOR_SIZE];
+
 void index_init();
-void index_where_the_sector(off_t length, uint8_t *level, uint8_t *idx1, uint8_t *idx2);
+block_sector_t index_lookup(const struct inode_disk *data, uint32_t sector_idx);
 bool index_extend(struct inode_disk *data, off_t new_length);
+size_t index_fill(struct inode_disk *data, uint32_t sector_idx, size_t cnt, block_sector_t *sector);
 void index_relese_sectors(struct inode_disk *data);
 
 #endif // !FILESYS_INDEX_H
@@ -8,8 +8,10 @@
 #include "filesys.h"
 #include "free-map.h"
 #include "cache.h"
+#include "journal.h"
 #include "../threads/malloc.h"
 #include "../threads/thread.h"
+#include "../threads/vaddr.h"
 #include "stdbool.h"
 
 /* Identifies an inode. */
@@ -30,56 +32,72 @@ bytes_to_sectors (off_t size)
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 // 返回file中pos位置所在的扇区编号
+// pos位于空洞中(尚未写入过)时返回0, 扇区0是free map的inode, 不会是数据扇区
 block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  struct inode_disk *data = cache_find_inode(inode->sector);
-  uint8_t level, idx1, idx2;
-  block_sector_t *table1;
-  block_sector_t *table2;
-  block_sector_t table1_sector;
-  block_sector_t sector;
-
-  index_where_the_sector(pos, &level, &idx1, &idx2);
-  switch (level) {
-    case 0:
-      sector = data->direct[idx1];
-      break;
-    case 1:
-      table1 = calloc(1, BLOCK_SECTOR_SIZE);
-      cache_read(data->indirect, table1, false);
-      sector = table1[idx1];
-      free(table1);
-      break;
-    case 2:
-      table2 = calloc(1, BLOCK_SECTOR_SIZE);
-      table1 = calloc(1, BLOCK_SECTOR_SIZE);
-      cache_read(data->double_indirect, table2, false);
-      table1_sector = table2[idx1];
-      ASSERT(table1_sector != 0);
-      cache_read(table1_sector, table1, false);
-      sector = table1[idx2];
-      free(table1);
-      free(table2);
-      break;
-  }
-  if (inode->sector != 0)
-  {
-    ASSERT(sector != 0)
-  }
-  return sector;
+  return index_lookup(&inode->data, pos / BLOCK_SECTOR_SIZE);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, so that opening a single inode twice returns
+   the same `struct inode'. */
+// 以扇区号为键的哈希表, open_inodes_lock保护哈希表以及每个inode的open_cnt和loading
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct inode, elem)->sector
+         < hash_entry (b, struct inode, elem)->sector;
+}
+
+// 将inode的元数据写入cache, 随后由cache的写回线程与其他扇区一起写回磁盘
+// 多次修改(如连续追加写入时的长度更新)只需写入cache一次
+// 调用者必须持有open_inodes_lock, 这里再持有inode的读锁, 避免拷贝到写入到一半的data
+// 加锁顺序: open_inodes_lock -> inode的读写锁, 持有inode的读写锁时不能再获取open_inodes_lock
+static void
+inode_flush (struct inode *inode)
+{
+  rwlock_acquire_read (&inode->rwlock);
+  if (inode->dirty && !inode->removed)
+    {
+      enum block_io_class old = block_set_io_class (BLOCK_IO_META);
+      cache_write (inode->sector, &inode->data);
+      block_set_io_class (old);
+      inode->dirty = false;
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
+// 将所有打开的inode中被修改过的元数据写入cache
+// 由cache的写回线程定期调用, 以及在文件系统关闭时调用
+void
+inode_flush_all (void)
+{
+  struct hash_iterator i;
+
+  lock_acquire (&open_inodes_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    inode_flush (hash_entry (hash_cur (&i), struct inode, elem));
+  lock_release (&open_inodes_lock);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -107,16 +125,18 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
       // 初始化disk_inode的数据
       // 文件初始长度为0
       disk_inode->length = 0;
-      memset(disk_inode->direct, 0, sizeof(block_sector_t) * 5);
-      disk_inode->indirect = 0;
-      disk_inode->double_indirect = 0;
+      disk_inode->sector_cnt = 0;
+      disk_inode->extent_cnt = 0;
+      disk_inode->extent_block = 0;
       disk_inode->magic = INODE_MAGIC;
       disk_inode->is_dir = is_dir;
-      // 为inode元数据分配扇区, free_map_allocate()中修改了inode的start位置
+      // 文件的内容只是一个空洞, 第一次写入时才分配扇区, 所以创建大文件几乎没有开销
       if (index_extend(disk_inode, length)) 
         {
-          // 将inode数据写入到磁盘中, 注意! 写入的不是文件数据!
-          cache_write (sector, disk_inode, true);
+          // 将inode数据写入到cache中, 注意! 写入的不是文件数据!
+          enum block_io_class old = block_set_io_class (BLOCK_IO_META);
+          cache_write (sector, disk_inode);
+          block_set_io_class (old);
           success = true; 
         } 
       // 此时, disk_inode中的数据已经写入到了磁盘中,
@@ -132,42 +152,58 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
-  struct thread *cur = thread_current();
+
   /* Check whether this inode is already open. */
   // 检查要打开的inode是否已经被打开过了
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          struct inode_disk *data = cache_find_inode(inode->sector);
-          // 违规的start值一定是其他进程尚未读取的
-          // 让出CPU让其他进程执行完毕
-          while(data->indirect == 0xcccccccc)
-            thread_yield();
-
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      // 第一个打开者还在读入元数据, 睡眠等待它读完
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-
-  struct inode_disk *data = calloc(1, sizeof(struct inode_disk));
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  cache_read(inode->sector, data, true);
+  inode->ra_next = 0;
+  inode->ra_end = 0;
+  inode->ra_window = 0;
+  inode->dirty = false;
+  inode->loading = true;
+  cond_init (&inode->loaded);
+  rwlock_init (&inode->rwlock);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  // 在锁外读入inode元数据, 读盘期间其他inode的打开不受影响
+  enum block_io_class old = block_set_io_class (BLOCK_IO_META);
+  cache_read (inode->sector, &inode->data);
+  block_set_io_class (old);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -176,7 +212,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -201,18 +241,26 @@ inode_close (struct inode *inode)
 
   /* Release resources if this was the last opener. */
   // 如果引用计数为0, 那么关闭文件
-  if (--inode->open_cnt == 0)
+  // 最后一个打开者先把元数据写入cache, 再从哈希表中移除
+  // 这样之后重新打开它的线程一定能从cache中读到最新的元数据
+  lock_acquire (&open_inodes_lock);
+  bool last = --inode->open_cnt == 0;
+  if (last)
+    {
+      inode_flush (inode);
+      hash_delete (&open_inodes, &inode->elem);
+    }
+  lock_release (&open_inodes_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          struct inode_disk *data = cache_find_inode(inode->sector);
           // 先free这个inode本身存储的扇区(free元数据)
           free_map_release (inode->sector, 1);
           // 再free整个文件的内容
-          index_relese_sectors(data);
+          index_relese_sectors(&inode->data);
         }
       free (inode); 
     }
@@ -228,16 +276,67 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+// 根据本次读取的位置判断是否为顺序读取, 并调整预读窗口
+// 顺序读取时窗口翻倍(不超过CACHE_RA_MAX_WINDOW), 随机读取时窗口清零
+// 随后把本次读取之后, 窗口之内尚未预读的扇区交给预读线程
+static void
+inode_readahead(struct inode *inode, off_t offset, off_t size)
+{
+  if (offset != inode->ra_next)
+  {
+    inode->ra_window = 0;
+    inode->ra_end    = 0;
+  }
+  else if (inode->ra_window == 0)
+    inode->ra_window = CACHE_RA_INIT_WINDOW;
+  else if (inode->ra_window < CACHE_RA_MAX_WINDOW)
+    inode->ra_window *= 2;
+  inode->ra_next = offset + size;
+
+  if (inode->ra_window == 0)
+    return ;
+
+  uint32_t first = DIV_ROUND_UP(offset + size, BLOCK_SECTOR_SIZE);
+  uint32_t last  = first + inode->ra_window;
+  uint32_t file_sectors = bytes_to_sectors(inode_length(inode));
+  if (first < inode->ra_end)
+    first = inode->ra_end;
+  if (last > file_sectors)
+    last = file_sectors;
+  if (first >= last)
+    return ;
+
+  cache_readahead(inode, first, last - first);
+  inode->ra_end = last;
+}
+
+// 为读写INODE的内容设置当前线程的I/O类别: 目录按元数据统计, 普通文件按数据统计
+// 调用者已经指定了类别(如free map)时保持不变, 返回原来的类别以便恢复
+static enum block_io_class
+inode_set_io_class (struct inode *inode)
+{
+  enum block_io_class old = block_set_io_class (BLOCK_IO_OTHER);
+  if (old != BLOCK_IO_OTHER)
+    block_set_io_class (old);
+  else
+    block_set_io_class (inode_is_dir (inode) ? BLOCK_IO_META : BLOCK_IO_DATA);
+  return old;
+}
+
+// inode_copy_range()以及用户缓冲区的读写每次通过内核缓冲区拷贝的字节数
+#define INODE_COPY_CHUNK (8 * BLOCK_SECTOR_SIZE)
+
+// 读写BUFFER时持有inode的锁, BUFFER必须在内核内存中(见inode_read_at())
+static off_t
+inode_do_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
-  off_t length = inode_length(inode);
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  enum block_io_class old_class = inode_set_io_class (inode);
+
+  // 同一个文件的多个读者可以并行读取
+  rwlock_acquire_read (&inode->rwlock);
+  off_t length = inode_length(inode);
 
   while (size > 0) 
     {
@@ -264,26 +363,15 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      // 如果offset所处的位置恰好在sector的开头且要读得数据长度恰好为BLOCK_SECTOR_SIZES
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          cache_read(sector_idx, buffer + bytes_read, false);
-        }
-      else 
+      // 空洞中的内容全为0, 不需要访问磁盘
+      // 否则直接从cache中拷贝需要的部分, 不经过bounce缓冲区
+      if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          // 暂时将一整个扇区的内容写入到bounce缓冲区中
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          cache_read (sector_idx, bounce, false);
-          //根据文件的实际长度信息, 将bounce中的内容拷贝到目标buffer中
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          uint8_t *cache_addr = cache_get (sector_idx, false);
+          memcpy (buffer + bytes_read, cache_addr + sector_ofs, chunk_size);
+          cache_put (sector_idx, false);
         }
       
       /* Advance. */
@@ -291,41 +379,73 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  // 为什么malloc了许多次, 只需要free一次???不会内存泄漏吗?
-  // Answer: 上面那个else部分在所有循环中只会执行一次, 是读取每个文件最末尾的部分!
-  free (bounce);
 
+  rwlock_release_read (&inode->rwlock);
+
+  // 提交预读时会获取open_inodes_lock, 必须先释放inode的读锁
+  if (bytes_read > 0)
+    inode_readahead(inode, offset - bytes_read, bytes_read);
+
+  block_set_io_class (old_class);
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+static off_t
+inode_do_write_at (struct inode *inode, const void *buffer_, off_t size,
+                   off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
-  struct inode_disk data;
-  data = *(struct inode_disk *)cache_find_inode(inode->sector);
+  struct inode_disk *data = &inode->data;
+  // 本次写入中新分配的扇区是[fresh_first, fresh_end), 它们在磁盘上的内容是无效的
+  uint32_t fresh_first = 0, fresh_end = 0;
+
+  // 写入可能修改索引和目录, 属于一个日志handle
+  // free map由写回线程在持有free_map_lock时写入, 它有自己的intent log, 不经过日志
+  bool journaled = inode->sector != FREE_MAP_SECTOR;
+  if (journaled)
+    journal_begin ();
+
+  // 写入可能分配扇区, 修改data, 所以独占inode
+  rwlock_acquire_write (&inode->rwlock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->rwlock);
+      if (journaled)
+        journal_end ();
+      return 0;
+    }
+  enum block_io_class old_class = inode_set_io_class (inode);
 
   while (size > 0) 
     {
       // 如果向超出文件长度的offset写入数据, 那么扩展文件
-      if (size + offset > data.length)
+      // 修改的是内存中的元数据, 标记为脏后由inode_flush()写入cache
+      if (size + offset > data->length)
       {
-        index_extend(&data, offset + size);
-        cache_write(inode->sector, &data, true);
+        bool extended = index_extend(data, offset + size);
+        inode->dirty = true;
+        // 磁盘空间不足, 只写入已有空间能容纳的部分
+        if (!extended)
+          break;
       }
       /* Sector to write, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      uint32_t idx = offset / BLOCK_SECTOR_SIZE;
+
+      // 写入空洞时才分配扇区, 一次分配本次写入在这个空洞中需要的全部扇区
+      if (sector_idx == 0)
+        {
+          size_t want = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE) - idx;
+          size_t got = index_fill (data, idx, want, &sector_idx);
+          inode->dirty = true;
+          // 磁盘空间不足
+          if (got == 0)
+            break;
+          fresh_first = idx;
+          fresh_end = idx + got;
+        }
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -340,30 +460,19 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
           /* Write full sector directly to disk. */
-          cache_write (sector_idx, buffer + bytes_written, false);
+          cache_write (sector_idx, buffer + bytes_written);
         }
       else 
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          // 如果这个扇区中除了我们需要的文件还有其他的内容
-          // 那么我们需要在文件写入前将原有的数据保存备份一份
-          // 避免一次写入造成扇区中的部分数据丢失
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            cache_read (sector_idx, bounce, false);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_write (sector_idx, bounce, false);
+          /* The sector contains data before or after the chunk
+             we're writing, so modify it in place in the cache. */
+          // 扇区中除了要写入的部分还有其他内容, 直接在cache中修改这一部分
+          // 新分配的扇区只被写入一部分时, 其余部分必须是0, 先在cache中填充0
+          if (idx >= fresh_first && idx < fresh_end)
+            cache_write (sector_idx, zeros);
+          uint8_t *cache_addr = cache_get (sector_idx, true);
+          memcpy (cache_addr + sector_ofs, buffer + bytes_written, chunk_size);
+          cache_put (sector_idx, true);
         }
 
       /* Advance. */
@@ -371,18 +480,166 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
+
+  block_set_io_class (old_class);
+  rwlock_release_write (&inode->rwlock);
+  if (journaled)
+    journal_end ();
+  return bytes_written;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
+// 访问用户缓冲区可能发生page fault, 缺页处理可能读入同一个文件的mmap页面, 或者驱逐页面,
+// 所以持有inode的锁或日志handle时不能访问用户内存
+// 用户缓冲区分段经过内核缓冲区, 只在不持有任何锁时与用户内存之间复制
+off_t
+inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
+{
+  if (!is_user_vaddr (buffer_))
+    return inode_do_read_at (inode, buffer_, size, offset);
+
+  uint8_t *buffer = buffer_;
+  uint8_t *bounce = malloc (INODE_COPY_CHUNK);
+  if (bounce == NULL)
+    return 0;
+
+  off_t bytes_read = 0;
+  while (size > 0)
+    {
+      off_t chunk_size = size < INODE_COPY_CHUNK ? size : INODE_COPY_CHUNK;
+      off_t got = inode_do_read_at (inode, bounce, chunk_size, offset);
+      memcpy (buffer + bytes_read, bounce, got);
+      size -= got;
+      offset += got;
+      bytes_read += got;
+      if (got < chunk_size)
+        break;
+    }
   free (bounce);
+  return bytes_read;
+}
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if end of file is reached or an error occurs.
+   (Normally a write at end of file would extend the inode, but
+   growth is not yet implemented.) */
+// 与inode_read_at()相同, 用户缓冲区先复制到内核缓冲区, 再持有锁写入
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset)
+{
+  if (!is_user_vaddr (buffer_))
+    return inode_do_write_at (inode, buffer_, size, offset);
+
+  const uint8_t *buffer = buffer_;
+  uint8_t *bounce = malloc (INODE_COPY_CHUNK);
+  if (bounce == NULL)
+    return 0;
+
+  off_t bytes_written = 0;
+  while (size > 0)
+    {
+      off_t chunk_size = size < INODE_COPY_CHUNK ? size : INODE_COPY_CHUNK;
+      memcpy (bounce, buffer + bytes_written, chunk_size);
+      off_t put = inode_do_write_at (inode, bounce, chunk_size, offset);
+      size -= put;
+      offset += put;
+      bytes_written += put;
+      if (put < chunk_size)
+        break;
+    }
+  free (bounce);
   return bytes_written;
 }
 
+// 将IN中从in_ofs开始的size个字节拷贝到OUT的out_ofs处, 数据不经过用户空间
+// 源文件中整个扇区的空洞, 若目标位置也是空洞(或在EOF之后), 则只延长目标文件, 不分配扇区
+// 返回实际拷贝的字节数, 遇到源文件EOF或者目标磁盘已满时会少于size
+// 调用者需要保证IN与OUT相同时两个区间不重叠
+off_t
+inode_copy_range (struct inode *in, off_t in_ofs,
+                  struct inode *out, off_t out_ofs, off_t size)
+{
+  off_t copied = 0;
+
+  if (in_ofs >= inode_length (in) || out->deny_write_cnt)
+    return 0;
+  if (size > inode_length (in) - in_ofs)
+    size = inode_length (in) - in_ofs;
+  // 保证out_ofs + size不溢出, 下面按扇区前进时也就不会溢出
+  if (size > INT32_MAX - out_ofs)
+    size = INT32_MAX - out_ofs;
+
+  uint8_t *buffer = malloc (INODE_COPY_CHUNK);
+  if (buffer == NULL)
+    return 0;
+
+  while (size > 0)
+    {
+      bool in_hole = false;
+      if (in_ofs % BLOCK_SECTOR_SIZE == 0 && out_ofs % BLOCK_SECTOR_SIZE == 0
+          && size >= BLOCK_SECTOR_SIZE)
+        {
+          rwlock_acquire_read (&in->rwlock);
+          in_hole = byte_to_sector (in, in_ofs) == 0;
+          rwlock_release_read (&in->rwlock);
+        }
+      if (in_hole)
+        {
+          // 源扇区与目标扇区都是空洞, 目标文件的这一扇区本来就读出0
+          journal_begin ();
+          rwlock_acquire_write (&out->rwlock);
+          bool skip = out->deny_write_cnt == 0
+                      && byte_to_sector (out, out_ofs) == 0;
+          if (skip && out_ofs + BLOCK_SECTOR_SIZE > out->data.length)
+            {
+              skip = index_extend (&out->data, out_ofs + BLOCK_SECTOR_SIZE);
+              out->dirty = true;
+            }
+          rwlock_release_write (&out->rwlock);
+          journal_end ();
+          if (!skip)
+            in_hole = false;
+        }
+      if (in_hole)
+        {
+          size -= BLOCK_SECTOR_SIZE;
+          in_ofs += BLOCK_SECTOR_SIZE;
+          out_ofs += BLOCK_SECTOR_SIZE;
+          copied += BLOCK_SECTOR_SIZE;
+          continue;
+        }
+
+      off_t chunk_size = size < INODE_COPY_CHUNK ? size : INODE_COPY_CHUNK;
+      off_t bytes_read = inode_read_at (in, buffer, chunk_size, in_ofs);
+      if (bytes_read <= 0)
+        break;
+      off_t bytes_written = inode_write_at (out, buffer, bytes_read, out_ofs);
+      copied += bytes_written;
+      if (bytes_written != bytes_read)
+        break;
+
+      size -= bytes_read;
+      in_ofs += bytes_read;
+      out_ofs += bytes_read;
+    }
+
+  free (buffer);
+  return copied;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -391,23 +648,23 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  struct inode_disk *data = cache_find_inode(inode->sector);
-  return data->length;
+  return inode->data.length;
 }
 
 bool
 inode_is_dir(const struct inode *inode)
 {
-  struct inode_disk *data = cache_find_inode(inode->sector);
-  return data->is_dir;
+  return inode->data.is_dir;
 }
 
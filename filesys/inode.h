@@ -2,36 +2,56 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <hash.h>
 #include <list.h>
 #include "off_t.h"
 #include "../devices/block.h"
+#include "../threads/synch.h"
 
-#define DIRECT_BLOCKS 5
-#define INDIRECT_BLOCKS 128
+// inode中直接存放的extent数目, 更多的extent存放在间接extent块中
+#define INODE_DIRECT_EXTENTS 6
 struct bitmap;
 
+// 一段连续的扇区: 从start开始的length个扇区
+// start为0表示空洞, 这length个扇区尚未分配, 读出来全为0, 第一次写入时才分配
+struct inode_extent
+  {
+    block_sector_t start;
+    uint32_t length;
+  };
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+// 文件的数据按顺序存放在若干extent中, 前INODE_DIRECT_EXTENTS个存放在inode中
+// 其余的存放在由extent_block开始的间接extent块链表中, 见index.c
 struct inode_disk
   {
     bool is_dir;
     off_t length;                       /* File size in bytes. */
-    block_sector_t direct[DIRECT_BLOCKS];               /* First data sector. */
-    block_sector_t indirect;
-    block_sector_t double_indirect;
+    uint32_t sector_cnt;                /* extent覆盖的扇区数, 包括空洞 */
+    uint32_t extent_cnt;                /* extent总数 */
+    struct inode_extent extents[INODE_DIRECT_EXTENTS];
+    block_sector_t extent_block;        /* 第一个间接extent块, 0表示没有 */
     unsigned magic;                     /* Magic number. */
-    char unused[471];               /* Not used. */
+    char unused[440];               /* Not used. */
   };
 
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* 元数据正在被第一个打开者读入 */
+    struct condition loaded;            /* 读入完成时唤醒其他打开者 */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t ra_next;                      /* 顺序读取时下一次读取的预期位置 */
+    uint32_t ra_end;                    /* 已提交预读的末尾(文件内扇区序号) */
+    uint32_t ra_window;                 /* 预读窗口大小(扇区数), 0表示随机访问 */
+    bool dirty;                         /* data被修改过, 尚未写入cache */
+    struct inode_disk data;             /* inode元数据在内存中的副本 */
+    struct rwlock rwlock;               /* 读取内容持有读锁, 写入(可能修改data)持有写锁 */
   };
 
 void inode_init (void);
@@ -44,9 +64,12 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_copy_range (struct inode *in, off_t in_ofs,
+                        struct inode *out, off_t out_ofs, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 bool inode_is_dir(const struct inode *);
+void inode_flush_all (void);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,338 @@
+#include "journal.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "filesys.h"
+#include "free-map.h"
+#include "inode.h"
+#include "../devices/block.h"
+#include "../threads/malloc.h"
+#include "../threads/synch.h"
+#include "../threads/thread.h"
+
+// 元数据日志(write-ahead journal)
+// inode, 索引块和目录的修改都发生在cache中, 这些扇区被标记为journaled, 提交前不会写回原位置
+// 修改元数据的操作(创建, 删除, 写入等)由journal_begin()/journal_end()包围, 称为一个handle
+// journal_commit()阻止新的handle开始, 等待进行中的handle全部结束, 然后:
+// 0. 写回新分配的数据扇区, 把free map被修改的扇区也加入事务(见free_map_journal_prepare())
+// 1. 把这段时间内所有handle修改过的扇区连同描述块一次写入日志区
+// 2. 写入提交块, 写完提交块即视为事务已经提交
+// 3. 把这些扇区写回原位置(checkpoint), 再清空描述块
+// 多个handle的修改合并成一个事务提交(group commit), 提交由写回线程定期进行,
+// 或者在未提交的扇区过多时由开始新handle的线程进行
+// 挂载时只需重放日志区中已经提交的事务, 不用扫描整个磁盘
+// 被释放的扇区在提交时才在free map中释放, 提交完成前没有handle能重新分配它们
+
+#define JOURNAL_HEADER_MAGIC 0x4c4e524a  // "JRNL"
+#define JOURNAL_COMMIT_MAGIC 0x544d4d43  // "CMMT"
+
+// 一个事务最多包含的扇区数: 日志区还要放下描述块和提交块
+#define JOURNAL_MAX_BLOCKS (JOURNAL_SECTORS - 2)
+
+// 日志区的第一个扇区, 记录事务中每个扇区的原位置
+struct journal_header
+{
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t cnt;                 // 事务中的扇区数, 为0表示没有需要重放的事务
+  block_sector_t sectors[(BLOCK_SECTOR_SIZE - 3 * sizeof(uint32_t))
+                         / sizeof(block_sector_t)];
+};
+
+// 紧跟在cnt个扇区内容之后的提交块, seq, cnt和checksum都与描述块一致时事务才有效
+struct journal_commit_block
+{
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t cnt;
+  uint32_t checksum;
+  uint8_t unused[BLOCK_SECTOR_SIZE - 4 * sizeof(uint32_t)];
+};
+
+static bool journal_on;
+static struct lock journal_lock;
+static struct condition journal_cond;   // handle全部结束, 或者一次提交完成
+static int journal_active;              // 进行中的handle数
+static bool journal_committing;         // 正在提交, 新的handle必须等待
+static uint32_t journal_seq;            // 下一个事务的序号
+
+// 提交时使用的缓冲区: 描述块, 最多JOURNAL_MAX_BLOCKS个扇区内容, 提交块
+static uint8_t *journal_buf;
+static block_sector_t journal_sectors[JOURNAL_MAX_BLOCKS];
+
+// 统计: 提交的事务数, 写入日志的扇区数, 因超过日志容量而直接写回的扇区数
+static uint32_t journal_commit_cnt;
+static uint32_t journal_block_cnt;
+static uint32_t journal_overflow_cnt;
+
+// 测试用, 由启动参数-journal-crash开启: 关机时的最后一次提交写完提交块后就停止,
+// 不checkpoint, 也不再写回cache, 模拟提交后立即断电, 下次挂载时必须重放日志
+bool journal_crash_on_shutdown;
+static bool journal_crashing;
+
+static int
+journal_sector_cmp(const void *a_, const void *b_)
+{
+  block_sector_t a = *(const block_sector_t *)a_;
+  block_sector_t b = *(const block_sector_t *)b_;
+  return a < b ? -1 : a > b;
+}
+
+static inline void *
+journal_block(size_t i)
+{
+  return journal_buf + i * BLOCK_SECTOR_SIZE;
+}
+
+// 事务的校验和, 覆盖序号与全部扇区内容
+static uint32_t
+journal_checksum(uint32_t seq, size_t cnt)
+{
+  uint32_t sum = seq;
+  for (size_t i = 1; i <= cnt; i++)
+  {
+    const uint32_t *p = journal_block(i);
+    for (size_t j = 0; j < BLOCK_SECTOR_SIZE / sizeof *p; j++)
+      sum = (sum << 5 | sum >> 27) ^ p[j];
+  }
+  return sum;
+}
+
+// 写入一个空的描述块, 日志区中不再有需要重放的事务
+static void
+journal_clear(void)
+{
+  struct journal_header *hdr = journal_block(0);
+  memset(hdr, 0, BLOCK_SECTOR_SIZE);
+  hdr->magic = JOURNAL_HEADER_MAGIC;
+  hdr->seq   = journal_seq;
+  enum block_io_class old = block_set_io_class(BLOCK_IO_JOURNAL);
+  block_write(fs_device, JOURNAL_SECTOR, hdr);
+  block_set_io_class(old);
+}
+
+// 重放日志区中已经提交的事务, 返回重放的扇区数
+// 在cache中还没有任何元数据时调用, 直接写回原位置
+static size_t
+journal_replay(void)
+{
+  struct journal_header *hdr = journal_block(0);
+  size_t cnt = hdr->cnt;
+  if (cnt == 0 || cnt > JOURNAL_MAX_BLOCKS)
+    return 0;
+
+  struct journal_commit_block *cb = journal_block(cnt + 1);
+  for (size_t i = 1; i <= cnt + 1; i++)
+    block_read(fs_device, JOURNAL_SECTOR + i, journal_block(i));
+  // 没有提交块的事务在提交前崩溃, 直接丢弃
+  if (cb->magic != JOURNAL_COMMIT_MAGIC || cb->seq != hdr->seq || cb->cnt != cnt
+      || cb->checksum != journal_checksum(hdr->seq, cnt))
+    return 0;
+
+  for (size_t i = 0; i < cnt; i++)
+    block_write(fs_device, hdr->sectors[i], journal_block(i + 1));
+  return cnt;
+}
+
+// 初始化日志. 格式化时写入空的描述块, 否则重放上次崩溃时已提交的事务
+// 必须在free_map_open()以及任何元数据被读入cache之前调用
+void
+journal_init(bool format)
+{
+  ASSERT(sizeof(struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT(sizeof(struct journal_commit_block) == BLOCK_SECTOR_SIZE);
+
+  lock_init(&journal_lock);
+  cond_init(&journal_cond);
+  journal_buf = malloc(JOURNAL_SECTORS * BLOCK_SECTOR_SIZE);
+  if (journal_buf == NULL)
+    PANIC("journal_init(): Cannot allocate journal buffer");
+
+  if (!format)
+  {
+    struct journal_header *hdr = journal_block(0);
+    enum block_io_class old = block_set_io_class(BLOCK_IO_JOURNAL);
+    block_read(fs_device, JOURNAL_SECTOR, hdr);
+    if (hdr->magic != JOURNAL_HEADER_MAGIC)
+    {
+      // 旧格式的磁盘没有日志区, 这些扇区可能属于某个文件, 不能写入
+      block_set_io_class(old);
+      printf("journal: no journal on %s, journaling disabled\n",
+             block_name(fs_device));
+      return;
+    }
+    size_t cnt = journal_replay();
+    block_set_io_class(old);
+    if (cnt > 0)
+      printf("journal: replayed %zu sectors\n", cnt);
+    journal_seq = hdr->seq + 1;
+  }
+  journal_clear();
+
+  journal_on = true;
+  free_map_use_journal(true);
+}
+
+bool
+journal_enabled(void)
+{
+  return journal_on;
+}
+
+// 开始一个handle, 之后对元数据的修改都属于同一个事务
+// handle可以嵌套, 只有最外层的journal_begin()可能等待正在进行的提交,
+// 所以最外层的调用者不能持有任何文件系统的锁
+void
+journal_begin(void)
+{
+  struct thread *t = thread_current();
+  if (t->journal_depth++ > 0 || !journal_on)
+    return;
+
+  // 未提交的扇区过多时先提交, 避免它们占满cache
+  size_t limit = cache_size / 4;
+  if (limit > JOURNAL_MAX_BLOCKS)
+    limit = JOURNAL_MAX_BLOCKS;
+  if (cache_journal_cnt() >= limit)
+    journal_commit();
+
+  lock_acquire(&journal_lock);
+  while (journal_committing)
+    cond_wait(&journal_cond, &journal_lock);
+  journal_active++;
+  lock_release(&journal_lock);
+}
+
+// 结束journal_begin()开始的handle
+void
+journal_end(void)
+{
+  struct thread *t = thread_current();
+  ASSERT(t->journal_depth > 0);
+  if (--t->journal_depth > 0 || !journal_on)
+    return;
+
+  lock_acquire(&journal_lock);
+  if (--journal_active == 0)
+    cond_broadcast(&journal_cond, &journal_lock);
+  lock_release(&journal_lock);
+}
+
+// 将当前事务写入日志区并checkpoint, 调用者必须已经阻止了新的handle
+static void
+journal_write_transaction(void)
+{
+  // inode元数据只在内存中被修改, 先写入cache, 让它们也成为事务的一部分
+  inode_flush_all();
+  free_map_journal_prepare();
+
+  // 超过日志容量的事务只能直接写回原位置, 放弃原子性
+  size_t cnt;
+  while ((cnt = cache_journal_sectors(journal_sectors, JOURNAL_MAX_BLOCKS))
+         > JOURNAL_MAX_BLOCKS)
+  {
+    cache_journal_checkpoint(journal_sectors, JOURNAL_MAX_BLOCKS);
+    journal_overflow_cnt += JOURNAL_MAX_BLOCKS;
+  }
+  if (cnt == 0)
+    return;
+
+  qsort(journal_sectors, cnt, sizeof *journal_sectors, journal_sector_cmp);
+  struct journal_header *hdr = journal_block(0);
+  memset(hdr, 0, BLOCK_SECTOR_SIZE);
+  hdr->magic = JOURNAL_HEADER_MAGIC;
+  hdr->seq   = journal_seq;
+  hdr->cnt   = cnt;
+  memcpy(hdr->sectors, journal_sectors, cnt * sizeof *journal_sectors);
+
+  void *buffers[JOURNAL_SECTORS];
+  for (size_t i = 0; i <= cnt; i++)
+  {
+    if (i > 0)
+      cache_read(journal_sectors[i - 1], journal_block(i));
+    buffers[i] = journal_block(i);
+  }
+
+  struct journal_commit_block *cb = journal_block(cnt + 1);
+  memset(cb, 0, BLOCK_SECTOR_SIZE);
+  cb->magic    = JOURNAL_COMMIT_MAGIC;
+  cb->seq      = journal_seq;
+  cb->cnt      = cnt;
+  cb->checksum = journal_checksum(journal_seq, cnt);
+
+  // 描述块和扇区内容落盘之后才能写提交块
+  enum block_io_class old = block_set_io_class(BLOCK_IO_JOURNAL);
+  block_write_multi(fs_device, JOURNAL_SECTOR, cnt + 1, (const void *const *) buffers);
+  block_write(fs_device, JOURNAL_SECTOR + cnt + 1, cb);
+  block_set_io_class(old);
+
+  if (journal_crashing)
+  {
+    // 之后的提交会覆盖日志区, 关闭日志, 事务中的扇区保持journaled, 不会被写回
+    journal_on = false;
+    printf("journal: simulated crash after committing %zu sectors\n", cnt);
+    return;
+  }
+
+  cache_journal_checkpoint(journal_sectors, cnt);
+  journal_seq++;
+  journal_clear();
+
+  journal_commit_cnt++;
+  journal_block_cnt += cnt;
+}
+
+// 提交当前事务. 若其他线程正在提交, 等待它完成后返回
+// 调用者不能处于handle中(最外层journal_begin()开始之前除外)
+void
+journal_commit(void)
+{
+  if (!journal_on)
+  {
+    inode_flush_all();
+    return;
+  }
+
+  lock_acquire(&journal_lock);
+  if (journal_committing)
+  {
+    while (journal_committing)
+      cond_wait(&journal_cond, &journal_lock);
+    lock_release(&journal_lock);
+    return;
+  }
+  journal_committing = true;
+  while (journal_active > 0)
+    cond_wait(&journal_cond, &journal_lock);
+  lock_release(&journal_lock);
+
+  // 提交期间被释放的扇区已经在free map中释放, 提交完成后才允许新的handle分配它们
+  journal_write_transaction();
+
+  lock_acquire(&journal_lock);
+  journal_committing = false;
+  cond_broadcast(&journal_cond, &journal_lock);
+  lock_release(&journal_lock);
+}
+
+// 模拟在提交之后, checkpoint之前断电(见journal_crash_on_shutdown), 由filesys_done()调用
+void
+journal_crash(void)
+{
+  journal_crashing = true;
+  journal_commit();
+}
+
+void
+journal_print_stats(void)
+{
+  if (!journal_on)
+    return;
+  printf("Journal: %"PRIu32" commits, %"PRIu32" sectors logged, "
+         "%"PRIu32" sectors written back without logging\n",
+         journal_commit_cnt, journal_block_cnt, journal_overflow_cnt);
+}
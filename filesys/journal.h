@@ -0,0 +1,16 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+
+void journal_init(bool format);
+bool journal_enabled(void);
+void journal_begin(void);
+void journal_end(void);
+void journal_commit(void);
+void journal_crash(void);
+
+extern bool journal_crash_on_shutdown;
+void journal_print_stats(void);
+
+#endif // !FILESYS_JOURNAL_H
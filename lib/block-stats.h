@@ -0,0 +1,50 @@
+#ifndef __LIB_BLOCK_STATS_H
+#define __LIB_BLOCK_STATS_H
+
+#include <stdint.h>
+
+/* What a block transfer was done for.  The kernel tags each
+   transfer with the class of the code that started it. */
+enum block_io_class
+  {
+    BLOCK_IO_OTHER,             /* Untagged, e.g. fsutil or partition scan. */
+    BLOCK_IO_DATA,              /* Buffer cache: file data. */
+    BLOCK_IO_META,              /* Buffer cache: inodes, indexes, dirs. */
+    BLOCK_IO_SWAP,              /* Swap-in and swap-out. */
+    BLOCK_IO_FREE_MAP,          /* Free map and its intent log. */
+    BLOCK_IO_JOURNAL,           /* Metadata journal. */
+    BLOCK_IO_CLASS_CNT
+  };
+
+/* Number of latency histogram buckets.  Bucket I counts
+   transfers that took between 2**I and 2**(I+1) - 1 TSC cycles;
+   the last bucket also counts anything slower. */
+#define BLOCK_LATENCY_BUCKETS 32
+
+/* Statistics for one block device, as returned by the
+   blockstats system call. */
+struct block_stats
+  {
+    char name[16];                      /* Device name, e.g. "hda2". */
+    int type;                           /* enum block_type. */
+    uint32_t size;                      /* Size in sectors. */
+
+    uint64_t read_cnt;                  /* Sectors read. */
+    uint64_t write_cnt;                 /* Sectors written. */
+    uint64_t read_reqs;                 /* Read transfers. */
+    uint64_t write_reqs;                /* Write transfers. */
+    uint64_t read_bytes;                /* Bytes read. */
+    uint64_t write_bytes;               /* Bytes written. */
+    uint64_t class_bytes[BLOCK_IO_CLASS_CNT][2]; /* Bytes read [0] and
+                                                    written [1] by class. */
+
+    uint32_t read_latency[BLOCK_LATENCY_BUCKETS];  /* Read latency. */
+    uint32_t write_latency[BLOCK_LATENCY_BUCKETS]; /* Write latency. */
+
+    uint32_t depth;                     /* Transfers in flight now. */
+    uint32_t max_depth;                 /* Most transfers ever in flight. */
+    uint64_t depth_sum;                 /* Sum of depth seen by each new
+                                           transfer, counting itself. */
+  };
+
+#endif /* lib/block-stats.h */
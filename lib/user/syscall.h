@@ -2,6 +2,9 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <block-stats.h>
+#include <iovec.h>
+#include <dirent.h>
 #include "../debug.h"
 //上面这个include做过修改!
 //原先为<debug.h>
@@ -47,4 +50,15 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool blockstats (int idx, struct block_stats *);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_file_range (int fd_in, unsigned off_in, int fd_out, unsigned off_out,
+                     unsigned length);
+int getdents (int fd, struct dirent *, unsigned cnt);
+pid_t fork (void);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,55 @@
+/* Child process for par-read test.
+   Reads its own file and the shared file PASS_CNT times each,
+   alternating between the two a block at a time, and checks
+   the data. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/par-read.h"
+
+const char *test_name = "child-par-read";
+
+static char own_buf[FILE_SIZE];
+static char shared_buf[FILE_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  char own_name[16];
+  char block[512];
+  int child_idx;
+  int own_fd, shared_fd;
+  size_t pass, ofs;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (own_name, sizeof own_name, "file%d", child_idx);
+
+  random_init (child_idx + 1);
+  random_bytes (own_buf, sizeof own_buf);
+  random_init (0);
+  random_bytes (shared_buf, sizeof shared_buf);
+
+  CHECK ((own_fd = open (own_name)) > 1, "open \"%s\"", own_name);
+  CHECK ((shared_fd = open (shared_name)) > 1, "open \"%s\"", shared_name);
+  for (pass = 0; pass < PASS_CNT; pass++)
+    for (ofs = 0; ofs < FILE_SIZE; ofs += sizeof block) 
+      {
+        CHECK (pread (own_fd, block, sizeof block, ofs) == sizeof block,
+               "read \"%s\"", own_name);
+        compare_bytes (block, own_buf + ofs, sizeof block, ofs, own_name);
+        CHECK (pread (shared_fd, block, sizeof block, ofs) == sizeof block,
+               "read \"%s\"", shared_name);
+        compare_bytes (block, shared_buf + ofs, sizeof block, ofs,
+                       shared_name);
+      }
+  close (own_fd);
+  close (shared_fd);
+
+  return child_idx;
+}
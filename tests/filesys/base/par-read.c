@@ -0,0 +1,47 @@
+/* Spawns CHILD_CNT child processes that read concurrently.  Each
+   child reads a file of its own and a file shared with all the
+   other children, and checks what it reads, so that readers of
+   different files and readers of the same file overlap in the
+   kernel.  This only checks that concurrent readers see correct
+   data; it does not measure how the run time scales. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/par-read.h"
+
+static char buf[FILE_SIZE];
+
+static void
+make_file (const char *name, unsigned seed) 
+{
+  int fd;
+
+  CHECK (create (name, sizeof buf), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  random_init (seed);
+  random_bytes (buf, sizeof buf);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"%s\"", name);
+  msg ("close \"%s\"", name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  size_t i;
+
+  make_file (shared_name, 0);
+  for (i = 0; i < CHILD_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "file%zu", i);
+      make_file (name, i + 1);
+    }
+
+  exec_children ("child-par-read", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+}
@@ -0,0 +1,37 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(par-read) begin
+(par-read) create "shared"
+(par-read) open "shared"
+(par-read) write "shared"
+(par-read) close "shared"
+(par-read) create "file0"
+(par-read) open "file0"
+(par-read) write "file0"
+(par-read) close "file0"
+(par-read) create "file1"
+(par-read) open "file1"
+(par-read) write "file1"
+(par-read) close "file1"
+(par-read) create "file2"
+(par-read) open "file2"
+(par-read) write "file2"
+(par-read) close "file2"
+(par-read) create "file3"
+(par-read) open "file3"
+(par-read) write "file3"
+(par-read) close "file3"
+(par-read) exec child 1 of 4: "child-par-read 0"
+(par-read) exec child 2 of 4: "child-par-read 1"
+(par-read) exec child 3 of 4: "child-par-read 2"
+(par-read) exec child 4 of 4: "child-par-read 3"
+(par-read) wait for child 1 of 4 returned 0 (expected 0)
+(par-read) wait for child 2 of 4 returned 1 (expected 1)
+(par-read) wait for child 3 of 4 returned 2 (expected 2)
+(par-read) wait for child 4 of 4 returned 3 (expected 3)
+(par-read) end
+EOF
+pass;
@@ -0,0 +1,17 @@
+#ifndef TESTS_FILESYS_BASE_PAR_READ_H
+#define TESTS_FILESYS_BASE_PAR_READ_H
+
+/* Number of reader processes. */
+#define CHILD_CNT 4
+
+/* Size of each file, and how many times each child reads its
+   files from beginning to end. */
+#define FILE_SIZE 8192
+#define PASS_CNT 8
+
+/* Every child reads the shared file plus one file of its own.
+   The contents of file I are generated with random_init (I + 1),
+   those of the shared file with random_init (0). */
+static const char shared_name[] = "shared";
+
+#endif /* tests/filesys/base/par-read.h */
@@ -0,0 +1,51 @@
+/* Fills a file back to front with pwrite(), reads it back at
+   different offsets with pread(), and checks that neither call
+   moves the file position. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 2048
+#define WRITE_CHUNK 512
+#define READ_CHUNK 300
+static char buf[FILE_SIZE];
+static char rbuf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  size_t ofs;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+
+  msg ("pwrite \"data\" back to front");
+  for (ofs = FILE_SIZE; ofs > 0; ofs -= WRITE_CHUNK)
+    if (pwrite (fd, buf + ofs - WRITE_CHUNK, WRITE_CHUNK, ofs - WRITE_CHUNK)
+        != WRITE_CHUNK)
+      fail ("pwrite %d bytes at offset %zu failed", WRITE_CHUNK,
+            ofs - WRITE_CHUNK);
+  if (tell (fd) != 0)
+    fail ("pwrite moved the file position to %u", tell (fd));
+
+  msg ("pread \"data\"");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += READ_CHUNK)
+    {
+      size_t size = FILE_SIZE - ofs < READ_CHUNK ? FILE_SIZE - ofs : READ_CHUNK;
+      if (pread (fd, rbuf + ofs, size, ofs) != (int) size)
+        fail ("pread %zu bytes at offset %zu failed", size, ofs);
+    }
+  if (tell (fd) != 0)
+    fail ("pread moved the file position to %u", tell (fd));
+  compare_bytes (rbuf, buf, FILE_SIZE, 0, "data");
+
+  CHECK (pread (fd, rbuf, 1, FILE_SIZE) == 0, "pread at end of file");
+  msg ("close \"data\"");
+  close (fd);
+}
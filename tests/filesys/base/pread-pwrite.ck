@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pread-pwrite) begin
+(pread-pwrite) create "data"
+(pread-pwrite) open "data"
+(pread-pwrite) pwrite "data" back to front
+(pread-pwrite) pread "data"
+(pread-pwrite) pread at end of file
+(pread-pwrite) close "data"
+(pread-pwrite) end
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Writes a file from three buffers with one writev(), then reads
+   it back into three differently sized buffers with one readv(). */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 2048
+static char buf[FILE_SIZE];
+static char rbuf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  struct iovec iov[3];
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 100;
+  iov[1].iov_base = buf + 100;
+  iov[1].iov_len = 1000;
+  iov[2].iov_base = buf + 1100;
+  iov[2].iov_len = FILE_SIZE - 1100;
+  CHECK (writev (fd, iov, 3) == FILE_SIZE, "writev \"data\"");
+  if (tell (fd) != FILE_SIZE)
+    fail ("file position is %u after writev, not %d", tell (fd), FILE_SIZE);
+
+  msg ("seek \"data\" to 0");
+  seek (fd, 0);
+  iov[0].iov_base = rbuf;
+  iov[0].iov_len = 700;
+  iov[1].iov_base = rbuf + 700;
+  iov[1].iov_len = 700;
+  iov[2].iov_base = rbuf + 1400;
+  iov[2].iov_len = FILE_SIZE - 1400;
+  CHECK (readv (fd, iov, 3) == FILE_SIZE, "readv \"data\"");
+  compare_bytes (rbuf, buf, FILE_SIZE, 0, "data");
+
+  CHECK (readv (fd, iov, 3) == 0, "readv at end of file");
+  msg ("close \"data\"");
+  close (fd);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(readv-writev) begin
+(readv-writev) create "data"
+(readv-writev) open "data"
+(readv-writev) writev "data"
+(readv-writev) seek "data" to 0
+(readv-writev) readv "data"
+(readv-writev) readv at end of file
+(readv-writev) close "data"
+(readv-writev) end
+EOF
+pass;
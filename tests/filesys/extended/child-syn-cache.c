@@ -0,0 +1,69 @@
+/* Child process for syn-cache.
+   Alternates between rewriting one of its own sectors of the
+   shared file and reading a range of sectors that may belong to
+   any child, checking that each sector read is uniform. */
+
+#include <random.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-cache.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-syn-cache";
+
+static char buf[SECTOR_SIZE * READ_SECTORS];
+
+static void
+check_uniform (const char *sector, size_t sector_idx) 
+{
+  size_t i;
+
+  for (i = 1; i < SECTOR_SIZE; i++)
+    if (sector[i] != sector[0])
+      fail ("sector %zu of \"%s\" is torn at byte %zu: %02hhx != %02hhx",
+            sector_idx, file_name, i, sector[i], sector[0]);
+}
+
+int
+main (int argc, const char *argv[]) 
+{
+  int child_idx;
+  int fd;
+  int iter;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  random_init (child_idx);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (iter = 0; iter < ITER_CNT; iter++)
+    {
+      size_t sector = random_ulong () % SECTOR_CNT;
+      size_t cnt = READ_SECTORS;
+      size_t i;
+
+      /* Write one of our own sectors. */
+      sector = sector - sector % CHILD_CNT + child_idx;
+      memset (buf, child_idx * ITER_CNT + iter, SECTOR_SIZE);
+      seek (fd, sector * SECTOR_SIZE);
+      CHECK (write (fd, buf, SECTOR_SIZE) == SECTOR_SIZE,
+             "write sector %zu of \"%s\"", sector, file_name);
+
+      /* Read a range that spans other children's sectors. */
+      sector = random_ulong () % SECTOR_CNT;
+      if (sector + cnt > SECTOR_CNT)
+        cnt = SECTOR_CNT - sector;
+      seek (fd, sector * SECTOR_SIZE);
+      CHECK (read (fd, buf, cnt * SECTOR_SIZE) == (int) (cnt * SECTOR_SIZE),
+             "read sectors %zu...%zu of \"%s\"",
+             sector, sector + cnt - 1, file_name);
+      for (i = 0; i < cnt; i++)
+        check_uniform (buf + i * SECTOR_SIZE, sector + i);
+    }
+  close (fd);
+
+  return child_idx;
+}
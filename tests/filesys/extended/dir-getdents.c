@@ -0,0 +1,58 @@
+/* Creates more files in a directory than getdents() decodes in one
+   kernel batch, then lists the directory with getdents() in small
+   batches and checks that every file shows up exactly once. */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 40
+#define BATCH 7
+
+void
+test_main (void) 
+{
+  struct dirent ents[BATCH];
+  bool seen[FILE_CNT];
+  char name[16];
+  int fd, i, n, total;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  msg ("creating d/f0...d/f%d", FILE_CNT - 1);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "d/f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+
+  msg ("getdents \"d\"");
+  memset (seen, 0, sizeof seen);
+  total = 0;
+  while ((n = getdents (fd, ents, BATCH)) > 0)
+    for (i = 0; i < n; i++)
+      {
+        int idx = atoi (ents[i].name + 1);
+        snprintf (name, sizeof name, "f%d", idx);
+        if (ents[i].is_dir || idx < 0 || idx >= FILE_CNT
+            || strcmp (ents[i].name, name))
+          fail ("unexpected entry \"%s\"", ents[i].name);
+        if (seen[idx])
+          fail ("\"%s\" listed twice", ents[i].name);
+        seen[idx] = true;
+        total++;
+      }
+  if (n < 0)
+    fail ("getdents failed");
+  if (total != FILE_CNT)
+    fail ("getdents returned %d entries, expected %d", total, FILE_CNT);
+
+  CHECK (getdents (fd, ents, BATCH) == 0, "getdents at end of directory");
+  msg ("close \"d\"");
+  close (fd);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "d"
+(dir-getdents) creating d/f0...d/f39
+(dir-getdents) open "d"
+(dir-getdents) getdents "d"
+(dir-getdents) getdents at end of directory
+(dir-getdents) close "d"
+(dir-getdents) end
+EOF
+pass;
@@ -0,0 +1,40 @@
+/* Creates files in a new directory and removes another one, then
+   lets the kernel stop right after its final journal commit
+   (-journal-crash), as if power were lost before checkpointing.
+   The persistence check can only find the files if mounting the
+   disk again replays the journal. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 3000
+static char buf_a[FILE_SIZE];
+static char buf_b[FILE_SIZE];
+
+static void
+write_file (const char *file_name, const char *buf)
+{
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void)
+{
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  random_bytes (buf_b, sizeof buf_b);
+
+  CHECK (create ("junk", 4096), "create \"junk\"");
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  write_file ("d/a", buf_a);
+  CHECK (remove ("junk"), "remove \"junk\"");
+  write_file ("d/b", buf_b);
+}
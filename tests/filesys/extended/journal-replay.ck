@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOT']);
+(journal-replay) begin
+(journal-replay) create "junk"
+(journal-replay) mkdir "d"
+(journal-replay) create "d/a"
+(journal-replay) open "d/a"
+(journal-replay) write "d/a"
+(journal-replay) close "d/a"
+(journal-replay) remove "junk"
+(journal-replay) create "d/b"
+(journal-replay) open "d/b"
+(journal-replay) write "d/b"
+(journal-replay) close "d/b"
+(journal-replay) end
+EOT
+pass;
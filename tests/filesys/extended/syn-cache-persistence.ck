@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"child-syn-cache" => "tests/filesys/extended/child-syn-cache",
+		"cachefile" => [join ('', map (chr ($_) x 512, 0...95))]});
+pass;
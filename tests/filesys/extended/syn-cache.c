@@ -0,0 +1,51 @@
+/* Stresses the buffer cache with concurrent readers and writers.
+   Each child overwrites whole sectors of a shared file that is
+   larger than the cache, while reading multi-sector ranges
+   written by the others.  Every sector is always filled with a
+   single byte value, so a torn or stale sector is detected as
+   a sector holding more than one value.  Afterward the parent
+   rewrites the file with a known pattern and checks it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-cache.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[FILE_SIZE];
+
+static void
+fill_pattern (void) 
+{
+  size_t i;
+
+  for (i = 0; i < SECTOR_CNT; i++)
+    memset (buf + i * SECTOR_SIZE, i, SECTOR_SIZE);
+}
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  fill_pattern ();
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE,
+         "write %d bytes to \"%s\"", FILE_SIZE, file_name);
+
+  exec_children ("child-syn-cache", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  /* Throughput is this byte count over the kernel's tick count. */
+  msg ("children moved %d bytes through the cache",
+       CHILD_CNT * ITER_CNT * SECTOR_SIZE * (READ_SECTORS + 1));
+
+  seek (fd, 0);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE,
+         "rewrite \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, FILE_SIZE);
+}
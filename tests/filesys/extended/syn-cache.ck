@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-cache) begin
+(syn-cache) create "cachefile"
+(syn-cache) open "cachefile"
+(syn-cache) write 49152 bytes to "cachefile"
+(syn-cache) exec child 1 of 4: "child-syn-cache 0"
+(syn-cache) exec child 2 of 4: "child-syn-cache 1"
+(syn-cache) exec child 3 of 4: "child-syn-cache 2"
+(syn-cache) exec child 4 of 4: "child-syn-cache 3"
+(syn-cache) wait for child 1 of 4 returned 0 (expected 0)
+(syn-cache) wait for child 2 of 4 returned 1 (expected 1)
+(syn-cache) wait for child 3 of 4 returned 2 (expected 2)
+(syn-cache) wait for child 4 of 4 returned 3 (expected 3)
+(syn-cache) children moved 2048000 bytes through the cache
+(syn-cache) rewrite "cachefile"
+(syn-cache) close "cachefile"
+(syn-cache) open "cachefile" for verification
+(syn-cache) verified contents of "cachefile"
+(syn-cache) close "cachefile"
+(syn-cache) end
+EOF
+pass;
@@ -0,0 +1,14 @@
+#ifndef TESTS_FILESYS_EXTENDED_SYN_CACHE_H
+#define TESTS_FILESYS_EXTENDED_SYN_CACHE_H
+
+/* The file is larger than the buffer cache, so the children
+   keep evicting each other's sectors. */
+#define SECTOR_SIZE 512
+#define SECTOR_CNT 96
+#define FILE_SIZE (SECTOR_SIZE * SECTOR_CNT)
+#define CHILD_CNT 4
+#define ITER_CNT 200
+#define READ_SECTORS 4
+static const char file_name[] = "cachefile";
+
+#endif /* tests/filesys/extended/syn-cache.h */
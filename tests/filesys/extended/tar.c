@@ -132,6 +132,23 @@ archive_ordinary_file (const char *file_name, int file_fd,
                      archive_fd, write_error))
     return false;
 
+  /* Copy whole blocks inside the kernel.  The loop below handles
+     the final partial block and anything left over after a short
+     copy. */
+  if (file_size >= 512) 
+    {
+      int archive_ofs = tell (archive_fd);
+      int copied = copy_file_range (file_fd, 0, archive_fd, archive_ofs,
+                                    file_size / 512 * 512);
+      if (copied > 0) 
+        {
+          copied = copied / 512 * 512;
+          seek (file_fd, copied);
+          seek (archive_fd, archive_ofs + copied);
+          file_size -= copied;
+        }
+    }
+
   while (file_size > 0) 
     {
       static char buf[512];
@@ -0,0 +1,18 @@
+/* Passes getdents() a count so large that multiplying it by
+   sizeof (struct dirent) wraps around to a small size.
+   The process must be terminated with -1 exit code. */
+
+#include <dirent.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct dirent ents[1];
+  unsigned cnt = (unsigned) (0x100000000ULL / sizeof *ents) + 1;
+
+  getdents (0, ents, cnt);
+  fail ("should not have survived getdents()");
+}
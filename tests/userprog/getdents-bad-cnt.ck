@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-bad-cnt) begin
+getdents-bad-cnt: exit(-1)
+EOF
+pass;
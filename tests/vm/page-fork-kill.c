@@ -0,0 +1,54 @@
+/* Forks a child that shares the parent's memory copy-on-write
+   and then dies of a divide error.  Killing the child must not
+   free the frames the parent still maps: the parent fills fresh
+   memory afterwards and verifies that its copy is unchanged. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 4096)
+
+static char buf[SIZE];
+static char fresh[SIZE];
+
+static void
+check (char c)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("byte %zu is %02hhx instead of %02hhx", i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      volatile int zero = 0;
+
+      msg ("child: verify");
+      check (0x5a);
+      msg ("child: divide by zero");
+      msg ("child: survived with %d", 1 / zero);
+      exit (81);
+    }
+  if (pid < 0)
+    fail ("fork");
+  CHECK (wait (pid) == -1, "wait for child");
+
+  msg ("parent: fill fresh memory");
+  memset (fresh, 0xa5, sizeof fresh);
+  msg ("parent: verify");
+  check (0x5a);
+}
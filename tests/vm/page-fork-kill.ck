@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+# The child is killed by a divide error, which IGNORE_USER_FAULTS
+# does not cover, so drop its register dump here.
+@output = grep (!/: dying due to interrupt 0x00 \(.*\).$/
+		&& !/^Interrupt 0x00 \(.*\) at eip=/
+		&& !/^ cr2=.* error=.*/
+		&& !/^ eax=.* ebx=.* ecx=.* edx=.*/
+		&& !/^ esi=.* edi=.* esp=.* ebp=.*/
+		&& !/^ cs=.* ds=.* es=.* ss=.*/, @output);
+compare_output ("run", \@output, [<<'EOF']);
+(page-fork-kill) begin
+(page-fork-kill) initialize
+(page-fork-kill) fork
+(page-fork-kill) child: verify
+(page-fork-kill) child: divide by zero
+page-fork-kill: exit(-1)
+(page-fork-kill) wait for child
+(page-fork-kill) parent: fill fresh memory
+(page-fork-kill) parent: verify
+(page-fork-kill) end
+page-fork-kill: exit(0)
+EOF
+pass;
@@ -0,0 +1,63 @@
+/* Forks a child that modifies 256 kB of copied memory, both
+   directly and through read(), and verifies that the parent's
+   copy is unchanged when the child has exited. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PGSIZE 4096
+#define SIZE (64 * 4096)
+
+static char buf[SIZE];
+
+static void
+check (char c)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("byte %zu is %02hhx instead of %02hhx", i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  char page[PGSIZE];
+  int fd;
+  pid_t pid;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+  memset (page, 0xa5, sizeof page);
+  CHECK (create ("data", PGSIZE), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, page, PGSIZE) == PGSIZE, "write \"data\"");
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      msg ("child: verify");
+      check (0x5a);
+      memset (buf, 0xa5, SIZE - PGSIZE);
+      seek (fd, 0);
+      if (read (fd, buf + SIZE - PGSIZE, PGSIZE) != PGSIZE)
+        fail ("child: read \"data\"");
+      memset (page, 0x5a, sizeof page);
+      msg ("child: verify modified copy");
+      check (0xa5);
+      exit (81);
+    }
+  if (pid < 0)
+    fail ("fork");
+  CHECK (wait (pid) == 81, "wait for child");
+
+  msg ("parent: verify");
+  check (0x5a);
+  if (page[0] != (char) 0xa5 || page[PGSIZE - 1] != (char) 0xa5)
+    fail ("stack page modified by child");
+  close (fd);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-fork) begin
+(page-fork) initialize
+(page-fork) create "data"
+(page-fork) open "data"
+(page-fork) write "data"
+(page-fork) fork
+(page-fork) child: verify
+(page-fork) child: verify modified copy
+(page-fork) wait for child
+(page-fork) parent: verify
+(page-fork) end
+EOF
+pass;
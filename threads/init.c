@@ -39,6 +39,8 @@
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/cache.h"
+#include "filesys/journal.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -292,6 +294,12 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef FILESYS
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-journal-crash"))
+        journal_crash_on_shutdown = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -415,6 +423,10 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef FILESYS
+          "  -cache=SECTORS     Use a buffer cache of SECTORS sectors.\n"
+          "  -journal-crash     Stop after the final journal commit at shutdown.\n"
 #endif
           );
   shutdown_power_off ();
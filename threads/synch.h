@@ -50,6 +50,25 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.
+   多个读者可以同时持有, 写者独占. 有写者在等待时新的读者会排队,
+   避免写者饿死. */
+struct rwlock
+  {
+    struct lock lock;           /* 保护下面的字段. */
+    struct condition readers;   /* 等待读取的线程. */
+    struct condition writers;   /* 等待写入的线程. */
+    int reader_cnt;             /* 正在读取的线程数. */
+    int writer_waiting;         /* 正在等待写入的线程数. */
+    bool writing;               /* 是否有线程正在写入. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -120,7 +120,6 @@ thread_init (void)
   thread_vma_init(initial_thread);
   initial_thread->current_fd = 1;
   initial_thread->status = THREAD_RUNNING;
-  initial_thread->page_default_flags = 0;
   initial_thread->tid = allocate_tid ();
 }
 
@@ -144,7 +143,6 @@ thread_start (void)
 static void
 thread_vma_init(struct thread *t)
 {
-  t->vma.loading_exe      = false;
   t->vma.code_seg_begin   = NULL;
   t->vma.code_seg_end     = NULL;
   t->vma.data_seg_begin   = NULL;
@@ -472,7 +470,6 @@ thread_create (const char *name, int priority,
 
   //Project 3: Virtual memory
 
-  t->page_default_flags = 0;
   thread_vma_init(t);
 
   /* Add to run queue. */
@@ -69,7 +69,6 @@ struct mmap_vma_node
 
 struct vma 
 {
-  bool loading_exe;
   uint8_t mapid;
 
   void *code_seg_begin;
@@ -153,6 +152,8 @@ struct thread
     int base_priority;
     int64_t wake_time;
     block_sector_t wd;
+    enum block_io_class io_class;       /* Class of block I/O done by this thread. */
+    int journal_depth;                  /* Nesting depth of journal handles. */
     struct list_elem allelem;           /* List element for all threads list. */
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
@@ -173,7 +174,6 @@ struct thread
     int lock_cnt;
     int nice;
     int recent_cpu_fp;
-    uint32_t page_default_flags;
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -95,18 +95,10 @@ kill (struct intr_frame *f)
               thread_name (), f->vec_no, intr_name (f->vec_no));
       intr_dump_frame (f);
 
-      struct semaphore *sema = NULL;
-      struct thread *cur = thread_current();
-      if (cur->pwait_node != NULL)
-      {
-        cur->pwait_node->status = -1;
-        sema = &cur->pwait_node->sema;
-      }
-     
-      if (sema != NULL)
-        sema_up(sema);
-
-      thread_exit (); 
+      // 与exit()走同一条释放路径: 先解除mmap和共享页面的映射,
+      // 否则pagedir_destroy()会释放其他进程仍在使用的共享帧
+      syscall_exit (f, -1);
+      NOT_REACHED ();
 
     case SEL_KCSEG:
       /* Kernel's code segment, which indicates a kernel bug.
@@ -143,7 +135,6 @@ page_fault (struct intr_frame *f)
   bool write;        /* True: access was write, false: access was read. */
   bool user;         /* True: access by user, false: access by kernel. */
   bool from_user_vm; /* é æPage Faultçå°åæ¥èªç¨æ·åå­ç©ºé´ */
-  bool writable_flag;
   void *fault_addr;  /* Fault address. */
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -164,8 +155,6 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
   from_user_vm = is_user_vaddr(fault_addr);
-  // 我知道这一行看起来很奇怪, 但你要容忍!
-  writable_flag = !(cur->page_default_flags & FRM_NO_EVICT);
   
   // 用户空间发生的错误且addr指向了内核空间: 一定是不合法的访问! 杀死进程
   if (!from_user_vm && user)
@@ -178,7 +167,7 @@ page_fault (struct intr_frame *f)
   else
     cur->vma.stack_seg_begin = f->esp;
 
-  enum role role = page_check_role(cur, fault_addr, writable_flag);
+  enum role role = page_check_role(cur, fault_addr);
   if (role == SEG_UNUSED)
     syscall_exit(f, -1);   
 
@@ -191,9 +180,8 @@ page_fault (struct intr_frame *f)
       syscall_exit(f, -1);
   }
 
-  //用户进程尝试向CODE段与DATA段中写入数据, 必然是错误的!
-  //注意, 我们要保证此时不在加载exe
-  if (role == SEG_CODE && write && !cur->vma.loading_exe)
+  //用户进程尝试向CODE段中写入数据, 必然是错误的!
+  if (role == SEG_CODE && write)
     syscall_exit(f, -1);
 
   if (from_user_vm)
@@ -202,13 +190,22 @@ page_fault (struct intr_frame *f)
     // 如果没有在SPT里找到page:
     if (page == NULL)
     {
-      // 分配新页面
-      page_get_new_page(cur, fault_addr, cur->page_default_flags, role);
+      // 分配新页面, Code段与Data段的页面从可执行文件中读入
+      if (!page_get_new_page(cur, fault_addr, FRM_RW, role))
+        syscall_exit(f, -1);
      // 返回原位继续执行
       return ;
     }
     else 
     {
+      // 向fork()后共享的页面写入(用户进程或者内核在syscall中): 写时复制
+      // 可执行文件的共享页面都在Code段中, 上面已经处理过了
+      if (write && !not_present && page->sharing)
+      {
+        page_cow_break(cur, page);
+        return ;
+      }
+
       // TODO: 从swap中拉取内存页面
       // 如果用户进程在页面存在的情况下, 向只读内存区域进行读取, 一定是不合法的访问!
       if (write && user && !not_present)
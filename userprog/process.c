@@ -26,6 +26,7 @@
 
 static void* process_push_arguments(uint8_t *esp, char *args);
 static thread_func start_process NO_RETURN;
+static thread_func fork_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp, char *args);
 
 bool load_failed;
@@ -269,13 +270,6 @@ start_process (void *file_name_)
   sema_up(&cur->pwait_node->parent->exec_sema);
   if (load_failed)
     thread_exit();
-  
-  // 保证当前正在执行的文件不会被其他进程修改 
-  lock_acquire(&filesys_lock);
-  struct file *file = filesys_open(ROOT_DIR_SECTOR, cur->name);
-  file_deny_write(file);
-  lock_release(&filesys_lock);
-  cur->exec_file = file;
 
   /* Start the user process by simulating a return from an
      interrupt, implemented by intr_exit (in
@@ -287,6 +281,140 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+// fork()时父进程传给子进程的参数, 位于父进程的内核栈上
+// 父进程在子进程复制完成之前一直等待, 因此子进程可以直接读取父进程的各种资源
+struct fork_args
+{
+  struct thread *parent;
+  struct intr_frame if_;      // 父进程进入fork()时的中断帧, 子进程从这里返回用户态
+  bool success;
+};
+
+// 创建当前进程的副本, 子进程从fork()返回0, 父进程返回子进程的pid
+// 地址空间并不复制, 而是写时复制(见page_fork()); 打开的文件各自重新打开, 保留各自的position
+// 子进程复制完成后父进程才返回, 失败时返回TID_ERROR
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct thread *cur = thread_current();
+  struct fork_args args;
+  args.parent  = cur;
+  args.if_     = *f;
+  args.success = false;
+
+  tid_t tid = thread_create (cur->name, PRI_DEFAULT, fork_process, &args);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  sema_down(&cur->exec_sema);
+  return args.success ? tid : TID_ERROR;
+}
+
+// 在子进程cur中复制父进程parent的页目录, fd, 可执行文件与VMA
+static bool
+process_fork_copy (struct thread *parent, struct thread *cur)
+{
+  cur->wd = parent->wd;
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir == NULL)
+    return false;
+  process_activate ();
+
+  cur->exec_file = file_reopen(parent->exec_file);
+  if (cur->exec_file == NULL)
+    return false;
+  file_deny_write(cur->exec_file);
+
+  struct list_elem *e;
+  for (e = list_begin(&parent->fd_list); e != list_end(&parent->fd_list); e = list_next(e))
+  {
+    struct fd_node *pnode = list_entry(e, struct fd_node, elem);
+    struct fd_node *node = malloc(sizeof(struct fd_node));
+    if (node == NULL)
+      return false;
+    node->fd    = pnode->fd;
+    node->mapid = pnode->mapid;
+    node->file  = file_reopen(pnode->file);
+    if (node->file == NULL)
+    {
+      free(node);
+      return false;
+    }
+    file_seek(node->file, file_tell(pnode->file));
+    list_push_back(&cur->fd_list, &node->elem);
+  }
+  cur->current_fd = parent->current_fd;
+
+  if (!page_fork(parent, cur))
+    return false;
+
+  // page_fork()添加栈页面时修改了栈的VMA, 这里一并覆盖
+  cur->vma.mapid           = parent->vma.mapid;
+  cur->vma.code_seg_begin  = parent->vma.code_seg_begin;
+  cur->vma.code_seg_end    = parent->vma.code_seg_end;
+  cur->vma.data_seg_begin  = parent->vma.data_seg_begin;
+  cur->vma.data_seg_end    = parent->vma.data_seg_end;
+  cur->vma.stack_seg_begin = parent->vma.stack_seg_begin;
+  cur->vma.stack_seg_end   = parent->vma.stack_seg_end;
+
+  // fd仍然打开时mmap直接使用fd的文件, 与父进程中一致(见syscall_close())
+  struct list *mmap_list = &parent->vma.mmap_vma_list;
+  for (e = list_begin(mmap_list); e != list_end(mmap_list); e = list_next(e))
+  {
+    struct mmap_vma_node *pnode = list_entry(e, struct mmap_vma_node, elem);
+    struct mmap_vma_node *node = malloc(sizeof(struct mmap_vma_node));
+    if (node == NULL)
+      return false;
+    *node = *pnode;
+
+    struct fd_node *fnode = process_get_fd_node(cur, pnode->fd);
+    if (fnode != NULL && fnode->mapid == pnode->mapid)
+      node->file = fnode->file;
+    else
+      node->file = file_reopen(pnode->file);
+    if (node->file == NULL)
+    {
+      free(node);
+      return false;
+    }
+    list_push_back(&cur->vma.mmap_vma_list, &node->elem);
+  }
+  return true;
+}
+
+/* A thread function that copies the parent process and starts
+   it running from the parent's fork() call. */
+static void
+fork_process (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *parent = args->parent;
+  struct thread *cur = thread_current();
+  struct intr_frame if_ = args->if_;
+  bool success;
+
+  page_process_init(cur);
+  success = process_fork_copy(parent, cur);
+
+  // 唤醒父进程后args就不再可用了
+  args->success = success;
+  sema_up(&parent->exec_sema);
+
+  if (!success)
+  {
+    page_mmap_unmap_all(cur);
+    page_destroy_pagelist(cur);
+    process_destroy_fd_list(cur);
+    file_close(cur->exec_file);
+    thread_exit();
+  }
+
+  // 子进程的fork()返回0
+  if_.eax = 0;
+  __asm__ volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -468,19 +596,14 @@ load (const char *file_name, void (**eip) (void), void **esp, char *args)
   process_activate ();
 
   /* Open executable file. */
-  lock_acquire(&filesys_lock);
   file = filesys_open (ROOT_DIR_SECTOR, file_name);
-  lock_release(&filesys_lock);
   if (file == NULL) 
     {
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
 
-  //保证加载成功才将当前进程的可执行文件设置成该文件
-  //t->exec_file = file;
   /* Read and verify executable header. */
-  lock_acquire(&filesys_lock);
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
       || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
       || ehdr.e_type != 2
@@ -492,7 +615,6 @@ load (const char *file_name, void (**eip) (void), void **esp, char *args)
       printf ("load: %s: error loading executable\n", file_name);
       goto done; 
     }
-  lock_release(&filesys_lock);
 
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
@@ -504,10 +626,8 @@ load (const char *file_name, void (**eip) (void), void **esp, char *args)
         goto done;
       file_seek (file, file_ofs);
 
-      lock_acquire(&filesys_lock);
       if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
         goto done;
-      lock_release(&filesys_lock);
 
       file_ofs += sizeof phdr;
       switch (phdr.p_type) 
@@ -564,11 +684,16 @@ load (const char *file_name, void (**eip) (void), void **esp, char *args)
   /* Start address. */
   *eip = (void (*) (void)) ehdr.e_entry;
 
+  // 各个段的页面之后还要从可执行文件中读入, 因此加载成功后不关闭文件
+  // 保证当前正在执行的文件不会被其他进程修改, 进程退出时关闭它
+  file_deny_write (file);
+  t->exec_file = file;
   success = true;
 
  done:
   /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  if (!success)
+    file_close (file);
   return success;
 }
 
@@ -635,6 +760,8 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
 
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
+// 这里只在SPT中记录段的位置, 不分配也不读取任何页面
+// 页面在第一次被访问时由page fault从文件中读入, 没被访问过的代码永远不占用frame
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
@@ -643,81 +770,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  struct thread *cur = thread_current();
-  file_seek (file, ofs);
-
-  //为Code段设置初始值
-  if ((void *)upage < cur->vma.code_seg_begin || cur->vma.code_seg_begin == NULL)
-    cur->vma.code_seg_begin   = upage;
-
-  cur->vma.code_seg_end = upage;
-  cur->vma.loading_exe  = true;
-
-  while (read_bytes > 0 || zero_bytes > 0) 
-    {
-      enum role role = SEG_UNUSED;
-
-      // 这里其实取了个巧, 所有可写(writable)的段应该是数据段(Data Segment)
-      // 数据段是可被驱逐的!
-      if (writable)
-      {
-        // 给数据段的段首赋初值
-        if (cur->vma.data_seg_begin == NULL)
-        {
-          cur->vma.data_seg_begin = upage;
-          cur->vma.data_seg_end   = upage;
-        }
-        cur->page_default_flags   = FRM_ZERO | FRM_RW;  // 数据段是可被驱逐的!
-        role = SEG_DATA;
-      }
-      else
-      {
-        cur->page_default_flags   = FRM_ZERO | FRM_NO_EVICT | FRM_RW;  //先设置为可读写, 在加载后设置为只读
-        role = SEG_CODE;
-      }
-
-      // IMPORTANT :如果内存已满, 手动准备一页页面
-      // 此时不能等到用户进程读取子进程文件时再触发Page Fault再惰性加载页面!
-      // 这样做的结果是CATASTROPHICAL的!!!!!!
-      // 因为用户进程需要在持有ide设备锁的情况下, 尝试将某个内存页写入swap磁盘
-      // 而又会试图持有同一把锁, 引发恶性竞争与致命bug!
-      if (frame_full())
-        page_get_new_page(cur, upage, cur->page_default_flags, role);
-
-        /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-      /* Load this page. */
-      lock_acquire(&filesys_lock);
-      if (file_read (file, upage, page_read_bytes) != (int) page_read_bytes)
-        {
-          page_free_page(cur, upage);
-          return false; 
-        }
-      lock_release(&filesys_lock);
-      memset (upage + page_read_bytes, 0, page_zero_bytes);
-
-      // 读取后, 将需要只读的页面设置为只读
-      if (!writable)
-      {
-        uint32_t *pte = lookup_page(cur->pagedir, upage, false);
-        ASSERT(pte != NULL);
-        *pte &= ~(uint32_t)PTE_W;
-      }
-           /* Advance. */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      upage += PGSIZE;
-    }
-
-  cur->vma.loading_exe    = false;
-  cur->page_default_flags = 0;
-  //由于我们更改了某些页面的读写权限, 需要刷新TLB
-  invalidate_pagedir(cur->pagedir);
+  // 页面要到访问时才读入, 读不到完整的段只能在这里发现
+  if (ofs + read_bytes > (uint32_t) file_length (file))
+    return false;
 
-  return true;
+  return page_add_segment (thread_current (), file, ofs, upage,
+                           read_bytes, zero_bytes, writable);
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
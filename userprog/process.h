@@ -10,7 +10,10 @@
 
 extern bool load_failed;
 extern struct lock load_failure_lock;
+struct intr_frame;
+
 tid_t process_execute (const char *file_name);
+tid_t process_fork (const struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -8,6 +8,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <syscall-nr.h>
+#include <iovec.h>
+#include <dirent.h>
 #include "../threads/thread.h"
 #include "../threads/vaddr.h"
 #include "../threads/malloc.h"
@@ -45,8 +47,31 @@ static void syscall_chdir(struct intr_frame *);
 static void syscall_isdir(struct intr_frame *);
 static void syscall_readdir(struct intr_frame *);
 static void syscall_inumber(struct intr_frame *);
+static void syscall_blockstats(struct intr_frame *);
+static void syscall_pread(struct intr_frame *);
+static void syscall_pwrite(struct intr_frame *);
+static void syscall_readv(struct intr_frame *);
+static void syscall_writev(struct intr_frame *);
+static void syscall_copy_file_range(struct intr_frame *);
+static void syscall_getdents(struct intr_frame *);
+static void syscall_fork(struct intr_frame *);
 
 // arg0 位于栈中的低地址
+struct syscall_frame_5args{
+  uint32_t arg0;
+  uint32_t arg1;
+  uint32_t arg2;
+  uint32_t arg3;
+  uint32_t arg4;
+};
+
+struct syscall_frame_4args{
+  uint32_t arg0;
+  uint32_t arg1;
+  uint32_t arg2;
+  uint32_t arg3;
+};
+
 struct syscall_frame_3args{
   uint32_t arg0;
   uint32_t arg1;
@@ -76,6 +101,28 @@ retval(struct intr_frame *f, int32_t num)
   f->eax = num;  
 }
 
+// 检查[buffer, buffer + size)是否都位于用户空间, 不合法时杀死进程
+// 比较剩余空间而不是计算buffer + size, 后者在size很大时会回绕到用户空间
+static void
+syscall_check_buffer(struct intr_frame *f, const void *buffer, size_t size)
+{
+  if (buffer == NULL || !is_user_vaddr(buffer)
+      || size > (size_t)((const uint8_t *)PHYS_BASE - (const uint8_t *)buffer))
+    syscall_exit(f, FORCE_EXIT);
+}
+
+// 返回fd对应的普通文件, fd为stdin/stdout, 不存在或者是目录时返回NULL
+static struct file *
+syscall_get_data_file(uint32_t fd)
+{
+  if (fd == 0 || fd == 1)
+    return NULL;
+  struct file *file = process_from_fd_get_file(thread_current(), fd);
+  if (file == NULL || inode_is_dir(file->inode))
+    return NULL;
+  return file;
+}
+
 // 将一个路径分割为最后一个文件名以及其前面的路径(以最后一个slash作为分隔)
 // 只是简单的将filename和directory指针放在path字符串的适当位置上, 避免strcpy
 // 比如path = "/dev/proc/some/file" 
@@ -152,9 +199,7 @@ syscall_create(struct intr_frame *f)
   block_sector_t dir_sector = dir_parse(thread_current()->wd, directory);
   if (!dir_sector) goto  done;
 
-  lock_acquire(&filesys_lock);
   success = filesys_create(dir_sector, filename, initial_size);
-  lock_release(&filesys_lock);
 
 done:
   retval(f, success);
@@ -184,13 +229,11 @@ syscall_remove(struct intr_frame *f)
 
   // 判断是否是目录
   struct dir *dir = dir_open(inode_open(dir_sector));
-  struct inode_disk *data = cache_find_inode(dir_sector);
-  if (data->is_dir && !dir_is_empty(dir))
+  // dir_open()只有在dir_sector是目录时才成功
+  if (dir != NULL && !dir_is_empty(dir))
     goto done;
 
-  lock_acquire(&filesys_lock);
   success = filesys_remove(dir_sector, filename);
-  lock_release(&filesys_lock);
 
 done:
   dir_close(dir);
@@ -212,9 +255,7 @@ syscall_seek(struct intr_frame *f)
   if (file == NULL)
     return ;
 
-  lock_acquire(&filesys_lock);
   file_seek(file, pos);
-  lock_release(&filesys_lock);
 }
 
 static void
@@ -226,9 +267,7 @@ syscall_tell(struct intr_frame *f)
   if (file == NULL)
     return ;
 
-  lock_acquire(&filesys_lock);
   uint32_t pos = file_tell(file);
-  lock_release(&filesys_lock);
   retval(f, pos);
 }
 
@@ -267,9 +306,7 @@ syscall_open(struct intr_frame *f)
   block_sector_t dir_sector = dir_parse(thread_current()->wd, directory);
   if (!dir_sector) goto done;
 
-  lock_acquire(&filesys_lock);
   struct file *file = filesys_open(dir_sector, filename);
-  lock_release(&filesys_lock);
   // file==NULL的情况有内部内存分配错误, 以及未找到文件
   // 未找到文件的情况在此处处理
   // TODO: 逻辑漏洞! 如果是内部内存错误怎么办?
@@ -305,11 +342,36 @@ syscall_close(struct intr_frame *f)
     mnode->file = file_reopen(file);
   }
 
-  lock_acquire(&filesys_lock);
   file_close(file); 
-  lock_release(&filesys_lock);
   process_remove_fd_node(cur, fd);
-  cache_writeback_all();
+  // 脏扇区由cache的写回线程异步写回, close()不再同步刷新整个cache
+}
+
+//TODO: 未在frame_full时做内存安全性检查! 可能fail测试点!
+//如果在读入时内存已满, 我们需要手动分配内存
+//而不是等到ide_read()触发Page Fault后再处理
+static void
+syscall_prefault_buffer(struct thread *cur, void *buffer, size_t size)
+{
+  if (frame_full())
+  {
+    size_t pages = DIV_ROUND_UP(size, PGSIZE);
+    void *addr = buffer;
+    while (pages > 0)
+    {
+      struct page_node *pnode = page_seek(cur, addr);
+      enum role role = page_check_role(cur, addr);
+      // Code段与Data段的页面要从可执行文件中读入, 其余按栈处理
+      if (pnode == NULL)
+        page_get_new_page(cur, addr, FRM_NO_EVICT,
+                          role == SEG_CODE || role == SEG_DATA ? role : SEG_STACK);
+      else if (pnode->loc != LOC_MEMORY)
+        page_pull_page(cur, pnode);
+
+      addr += PGSIZE;
+      pages--;
+    }
+  }
 }
 
 static void
@@ -338,25 +400,7 @@ syscall_read(struct intr_frame *f)
     return ;
   }
 
-  //TODO: 未在frame_full时做内存安全性检查! 可能fail测试点!
-  //如果在读入时内存已满, 我们需要手动分配内存
-  //而不是等到ide_read()触发Page Fault后再处理
-  if (frame_full())
-  {
-    size_t pages = DIV_ROUND_UP(size, PGSIZE);
-    void *addr = buffer;
-    while (pages > 0)
-    {
-      struct page_node *pnode = page_seek(cur, addr);
-      if (pnode == NULL)
-        page_get_new_page(cur, addr, FRM_NO_EVICT, SEG_STACK);
-      else if (pnode->loc != LOC_MEMORY)
-        page_pull_page(cur, pnode);
-
-      addr += PGSIZE;
-      pages--;
-    }
-  }
+  syscall_prefault_buffer(cur, buffer, size);
 
   struct file *file = process_from_fd_get_file(thread_current(), fd);
   if (file == NULL)
@@ -364,9 +408,7 @@ syscall_read(struct intr_frame *f)
     retval(f, ERROR);
     return ;
   }
-  lock_acquire(&filesys_lock);
   size_t bytes = file_read(file, buffer, size);
-  lock_release(&filesys_lock);
   retval(f, bytes);
 }
 
@@ -407,12 +449,79 @@ syscall_readdir(struct intr_frame *f)
   char *name = (char *)args->arg1;
 
   struct file *file = process_from_fd_get_file(thread_current(), fd);
+  if (file == NULL)
+  {
+    retval(f, false);
+    return ;
+  }
+  // 目录的读取位置保存在file的position中, 与getdents()共用
   struct dir *dir = dir_open(inode_reopen(file->inode));
-  bool success = dir_readdir(dir, name);
+  bool success = false;
+  if (dir != NULL)
+  {
+    dir_seek(dir, file->pos);
+    success = dir_readdir(dir, name);
+    file->pos = dir_tell(dir);
+    dir_close(dir);
+  }
 
   retval(f, success);
 }
 
+// getdents()每次在内核中解码的目录项数
+// 解码时持有目录的读锁, 解码完并释放锁后再拷贝到用户空间
+#define GETDENTS_BATCH 32
+
+// 从目录fd的当前位置开始读取至多cnt个目录项, 返回读取的个数, 0表示已经读完
+// fd不是目录时返回ERROR
+static void
+syscall_getdents(struct intr_frame *f)
+{
+  struct syscall_frame_3args *args = (struct syscall_frame_3args *)get_args(f);
+  uint32_t fd = args->arg0;
+  struct dirent *ents = (struct dirent *)args->arg1;
+  size_t cnt = args->arg2;
+
+  // 先限制cnt再相乘, 否则cnt * sizeof *ents可能溢出成一个很小的值
+  if (cnt > (size_t)PHYS_BASE / sizeof *ents)
+    syscall_exit(f, FORCE_EXIT);
+  syscall_check_buffer(f, ents, cnt * sizeof *ents);
+  struct file *file = process_from_fd_get_file(thread_current(), fd);
+  struct dirent *batch = malloc(GETDENTS_BATCH * sizeof *batch);
+  if (file == NULL || batch == NULL)
+  {
+    free(batch);
+    retval(f, ERROR);
+    return ;
+  }
+
+  struct dir *dir = dir_open(inode_reopen(file->inode));
+  if (dir == NULL)
+  {
+    free(batch);
+    retval(f, ERROR);
+    return ;
+  }
+
+  syscall_prefault_buffer(thread_current(), ents, cnt * sizeof *ents);
+  size_t total = 0;
+  dir_seek(dir, file->pos);
+  while (total < cnt)
+  {
+    size_t want = cnt - total < GETDENTS_BATCH ? cnt - total : GETDENTS_BATCH;
+    size_t got = dir_readdir_batch(dir, batch, want);
+    memcpy(ents + total, batch, got * sizeof *batch);
+    total += got;
+    if (got < want)
+      break;
+  }
+  file->pos = dir_tell(dir);
+
+  dir_close(dir);
+  free(batch);
+  retval(f, total);
+}
+
 static void
 syscall_inumber(struct intr_frame *f)
 {
@@ -422,6 +531,165 @@ syscall_inumber(struct intr_frame *f)
   retval(f, file->inode->sector);
 }
 
+// 将第idx个块设备(按探测顺序)的I/O统计拷贝到用户提供的struct block_stats中
+// 没有第idx个设备时返回false
+static void
+syscall_blockstats(struct intr_frame *f)
+{
+  struct syscall_frame_2args *args = (struct syscall_frame_2args *)get_args(f);
+  int idx = args->arg0;
+  struct block_stats *stats = (struct block_stats *)args->arg1;
+
+  syscall_check_buffer(f, stats, sizeof *stats);
+
+  struct block *block = block_first();
+  for (int i = 0; i < idx && block != NULL; i++)
+    block = block_next(block);
+  if (idx < 0 || block == NULL)
+  {
+    retval(f, false);
+    return ;
+  }
+
+  struct block_stats st;
+  block_get_stats(block, &st);
+  memcpy(stats, &st, sizeof st);
+  retval(f, true);
+}
+
+// 从offset处读取, 不使用也不修改文件的position
+static void
+syscall_pread(struct intr_frame *f)
+{
+  struct syscall_frame_4args *args = (struct syscall_frame_4args *)get_args(f);
+  uint32_t fd = args->arg0;
+  void *buffer = (void *)args->arg1;
+  size_t size = args->arg2;
+  off_t offset = args->arg3;
+
+  syscall_check_buffer(f, buffer, size);
+  struct file *file = syscall_get_data_file(fd);
+  if (file == NULL || offset < 0)
+  {
+    retval(f, ERROR);
+    return ;
+  }
+
+  syscall_prefault_buffer(thread_current(), buffer, size);
+  off_t bytes = file_read_at(file, buffer, size, offset);
+  retval(f, bytes);
+}
+
+// 向offset处写入, 不使用也不修改文件的position
+static void
+syscall_pwrite(struct intr_frame *f)
+{
+  struct syscall_frame_4args *args = (struct syscall_frame_4args *)get_args(f);
+  uint32_t fd = args->arg0;
+  const void *buffer = (const void *)args->arg1;
+  size_t size = args->arg2;
+  off_t offset = args->arg3;
+
+  syscall_check_buffer(f, buffer, size);
+  struct file *file = syscall_get_data_file(fd);
+  if (file == NULL || offset < 0)
+  {
+    retval(f, ERROR);
+    return ;
+  }
+
+  off_t bytes = file_write_at(file, buffer, size, offset);
+  retval(f, bytes);
+}
+
+// readv()和writev()的公共部分: 从文件的position开始依次读写iov中的每个缓冲区
+// 某个缓冲区没有读写满时(EOF或磁盘已满)提前结束
+// 返回读写的总字节数
+static void
+syscall_transfer_iov(struct intr_frame *f, bool write)
+{
+  struct syscall_frame_3args *args = (struct syscall_frame_3args *)get_args(f);
+  uint32_t fd = args->arg0;
+  const struct iovec *iov = (const struct iovec *)args->arg1;
+  int iovcnt = args->arg2;
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX)
+  {
+    retval(f, ERROR);
+    return ;
+  }
+  syscall_check_buffer(f, iov, iovcnt * sizeof *iov);
+
+  struct iovec vec[IOV_MAX];
+  memcpy(vec, iov, iovcnt * sizeof *iov);
+  for (int i = 0; i < iovcnt; i++)
+  {
+    syscall_check_buffer(f, vec[i].iov_base, vec[i].iov_len);
+    if (!write)
+      syscall_prefault_buffer(thread_current(), vec[i].iov_base, vec[i].iov_len);
+  }
+
+  struct file *file = syscall_get_data_file(fd);
+  if (file == NULL)
+  {
+    retval(f, ERROR);
+    return ;
+  }
+
+  int32_t total = 0;
+  for (int i = 0; i < iovcnt; i++)
+  {
+    off_t bytes = write ? file_write(file, vec[i].iov_base, vec[i].iov_len)
+                        : file_read(file, vec[i].iov_base, vec[i].iov_len);
+    total += bytes;
+    if ((size_t)bytes != vec[i].iov_len)
+      break;
+  }
+  retval(f, total);
+}
+
+static void
+syscall_readv(struct intr_frame *f)
+{
+  syscall_transfer_iov(f, false);
+}
+
+static void
+syscall_writev(struct intr_frame *f)
+{
+  syscall_transfer_iov(f, true);
+}
+
+// 在内核中将fd_in从off_in开始的size个字节拷贝到fd_out的off_out处, 不修改两个文件的position
+// 同一个文件中重叠的区间返回ERROR
+static void
+syscall_copy_file_range(struct intr_frame *f)
+{
+  struct syscall_frame_5args *args = (struct syscall_frame_5args *)get_args(f);
+  struct file *in = syscall_get_data_file(args->arg0);
+  off_t off_in = args->arg1;
+  struct file *out = syscall_get_data_file(args->arg2);
+  off_t off_out = args->arg3;
+  off_t size = args->arg4;
+
+  // 区间末尾超出off_t范围时, 下面的重叠判断会溢出, 直接拒绝
+  if (in == NULL || out == NULL || off_in < 0 || off_out < 0 || size < 0
+      || size > INT32_MAX - off_in || size > INT32_MAX - off_out)
+  {
+    retval(f, ERROR);
+    return ;
+  }
+  if (in->inode == out->inode
+      && off_in < off_out + size && off_out < off_in + size)
+  {
+    retval(f, ERROR);
+    return ;
+  }
+
+  off_t bytes = inode_copy_range(in->inode, off_in, out->inode, off_out, size);
+  retval(f, bytes);
+}
+
 static void
 syscall_mkdir(struct intr_frame *f)
 {
@@ -490,6 +758,20 @@ syscall_exec(struct intr_frame *f)
     retval(f, pid);
 }
 
+// 子进程的mmap页面要重新从文件中读入, 先写回父进程修改过的mmap页面
+static void
+syscall_fork(struct intr_frame *f)
+{
+  struct thread *cur = thread_current();
+  struct list_elem *e;
+  for (e = list_begin(&cur->vma.mmap_vma_list); e != list_end(&cur->vma.mmap_vma_list);
+       e = list_next(e))
+    page_mmap_writeback(cur, list_entry(e, struct mmap_vma_node, elem)->mapid);
+
+  tid_t pid = process_fork(f);
+  retval(f, pid == TID_ERROR ? ERROR : (int32_t) pid);
+}
+
 static void
 syscall_wait(struct intr_frame *f)
 {
@@ -700,6 +982,30 @@ syscall_handler (struct intr_frame *f)
     case SYS_ISDIR:
       syscall_isdir(f);
       break;
+    case SYS_BLOCKSTATS:
+      syscall_blockstats(f);
+      break;
+    case SYS_PREAD:
+      syscall_pread(f);
+      break;
+    case SYS_PWRITE:
+      syscall_pwrite(f);
+      break;
+    case SYS_READV:
+      syscall_readv(f);
+      break;
+    case SYS_WRITEV:
+      syscall_writev(f);
+      break;
+    case SYS_COPY_FILE_RANGE:
+      syscall_copy_file_range(f);
+      break;
+    case SYS_GETDENTS:
+      syscall_getdents(f);
+      break;
+    case SYS_FORK:
+      syscall_fork(f);
+      break;
     default:
       printf("Unknown syscall number! Killing process...\n");
       syscall_exit(f, FORCE_EXIT);
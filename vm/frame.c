@@ -3,28 +3,87 @@
 #include <list.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <bitmap.h>
 #include "../threads/malloc.h"
 #include "../threads/thread.h"
 #include "../threads/palloc.h"
+#include "../filesys/file.h"
+#include "../filesys/inode.h"
 #include "../userprog/pagedir.h"
 #include "stdbool.h"
+#include "share.h"
 #include "swap.h"
 #include "virtual-memory.h"
 
 #define NO_ACCESSED 0;
 
+// 页面换出线程(page-out daemon)
+// 用户内存池中空闲的页面少于FRAME_FREE_LOW时被唤醒, 把空闲页面补充到FRAME_FREE_HIGH:
+// 1. 回收不需要I/O就能驱逐的页面(可执行文件的共享页面, 持有有效swap槽的干净页面), 释放它们的frame
+// 2. 不够时把一批未被访问的脏页面写入连续的swap槽(一条命令), 并清除它们的dirty位
+//    这些页面仍然留在内存中, 下一轮就可以被回收, 缺页的线程驱逐它们时也不用写入
+#define FRAME_FREE_LOW 8
+#define FRAME_FREE_HIGH 32
+#define PAGEOUT_ROUNDS 4
+
 struct list frame_list;
 struct list_elem *flist_ptr;
 struct lock flist_lock;
 uint32_t frame_cnt;
 
+static struct lock pageout_lock;
+static struct condition pageout_cond;
+static bool pageout_wanted;
+
+// 被驱逐的mmap脏页面在释放flist_lock之后才写回文件:
+// 写回可能开始一个日志handle并等待提交, 而提交要等待的线程可能正在等待flist_lock
+// 写回完成之前, 缺页的线程从文件中读入这一页时必须等待(见frame_mmap_wait())
+struct mmap_wb
+{
+  struct inode *inode;            //驱逐时重新打开的inode, 写回后关闭
+  off_t ofs;
+  uint32_t bytes;
+  struct list_elem elem;
+};
+static struct list mmap_wb_list;
+static struct lock mmap_wb_lock;
+static struct condition mmap_wb_done;
+
+static void frame_pageout_daemon(void *aux);
+
 void frame_init()
 {
   list_init(&frame_list);
   lock_init(&flist_lock);
   flist_ptr = list_begin(&frame_list);
   frame_cnt = 0;
+
+  list_init(&mmap_wb_list);
+  lock_init(&mmap_wb_lock);
+  cond_init(&mmap_wb_done);
+
+  lock_init(&pageout_lock);
+  cond_init(&pageout_cond);
+  pageout_wanted = false;
+  if (thread_create("pageout", PRI_DEFAULT, frame_pageout_daemon, NULL) == TID_ERROR)
+    PANIC("frame_init(): Cannot create page-out thread");
+}
+
+// 用户内存池中空闲的页面数
+static size_t
+frame_free_cnt(void)
+{
+  return bitmap_count(user_pool.used_map, 0, bitmap_size(user_pool.used_map), false);
+}
+
+static void
+frame_wake_pageout(void)
+{
+  lock_acquire(&pageout_lock);
+  pageout_wanted = true;
+  cond_signal(&pageout_cond, &pageout_lock);
+  lock_release(&pageout_lock);
 }
 
 // 为进程分配一页新的内存页面, 先获取一页kapge
@@ -50,6 +109,8 @@ frame_allocate_page(uint32_t *pd, uint32_t flags)
   palloc_flag = palloc_flag | PAL_USER;
 
   void *kpage = palloc_get_page(palloc_flag);
+  if (frame_free_cnt() < FRAME_FREE_LOW)
+    frame_wake_pageout();
   if (kpage == NULL)
   {
     free(node);
@@ -59,11 +120,15 @@ frame_allocate_page(uint32_t *pd, uint32_t flags)
   node->evictable = evictable;
   node->kaddr = kpage;
   node->page_node = NULL;
+  node->share = NULL;
 
+  // 页面换出线程会同时遍历frame_list
+  lock_acquire(&flist_lock);
   list_push_back(&frame_list, &node->elem);
 
   flist_ptr = &node->elem;
   frame_cnt++;
+  lock_release(&flist_lock);
 
   return node;
 }
@@ -76,10 +141,12 @@ frame_full()
 
 //完全销毁一个frame对象, 释放其对应的upage与kpage的内存空间
 //删除所有引用关系
+//调用者必须持有flist_lock, 页面换出线程会同时遍历frame_list
 void 
 frame_destroy_frame(struct frame_node *fnode)
 {
   ASSERT(fnode != NULL);
+  ASSERT(lock_held_by_current_thread(&flist_lock));
 
   if (&fnode->elem == flist_ptr)
     flist_ptr = list_prev(flist_ptr);
@@ -89,28 +156,76 @@ frame_destroy_frame(struct frame_node *fnode)
   free(fnode);
 }
 
+// swap已满时, 放弃内存中的页面缓存的swap槽(见frame_swap()), 它们再被驱逐时重新写入
+// 调用者必须持有flist_lock
+static void
+frame_drop_swap_cache(void)
+{
+  struct list_elem *e;
+  for (e = list_begin(&frame_list); e != list_end(&frame_list); e = list_next(e))
+  {
+    struct page_node *pnode = list_entry(e, struct frame_node, elem)->page_node;
+    if (pnode != NULL && pnode->swap_pg_idx != SIZE_MAX)
+    {
+      swap_free(pnode->swap_pg_idx);
+      pnode->swap_pg_idx = SIZE_MAX;
+    }
+  }
+}
+
 //将内存中的页面换入文件中或swap磁盘中
 //注意! 进程A可能选择将内存中进程B的页面写回磁盘
 //此时进程A需要访问进程B页面中的数据, 但页目录已经切换
 //无法通过访问B->upage的形式来获取B页面的数据
 //因此必须通过访问B->upage对应的kpage来获取数据!
 //因此传入swap_in的参数是kpage!
-static void
+//mmap的脏页面返回需要写回的位置, 由调用者在释放flist_lock后交给frame_mmap_writeback()
+static struct mmap_wb *
 frame_swap(struct thread *t, struct frame_node *fnode, bool dirty)
 {
   struct page_node *pnode = fnode->page_node;
   void *kpage = fnode->kaddr;
   void *upage = pnode->upage;
-  size_t page_idx = SIZE_MAX;
+  size_t page_idx = pnode->swap_pg_idx;
+  struct mmap_wb *wb = NULL;
 
   // 如果页面是脏页, 那么需要写回到文件或磁盘中
+  // 只读的Code页面都是共享的(见share_evict()), 这里的私有页面都可能被修改过, 不能直接丢弃
   if (pnode->role == SEG_MMAP)
   {
     struct mmap_vma_node *mnode = page_mmap_seek(t, USE_ADDR, upage);
-    page_mmap_writeback(t, mnode->mapid);
+    ASSERT(mnode != NULL);
+    if (dirty)
+    {
+      wb = malloc(sizeof(struct mmap_wb));
+      if (wb == NULL)
+        PANIC("frame_swap(): Cannot allocate memory for mmap writeback!\n");
+      size_t filesize = mnode->mmap_seg_end - mnode->mmap_seg_begin;
+      wb->ofs   = (uint8_t *)upage - (uint8_t *)mnode->mmap_seg_begin;
+      wb->bytes = filesize - wb->ofs >= PGSIZE ? PGSIZE : filesize - wb->ofs;
+      // 进程可能在写回期间munmap()或退出, 关闭它的文件
+      wb->inode = inode_reopen(file_get_inode(mnode->file));
+      lock_acquire(&mmap_wb_lock);
+      list_push_back(&mmap_wb_list, &wb->elem);
+      lock_release(&mmap_wb_lock);
+    }
   } 
   else
-    page_idx = swap_in(kpage);
+  {
+    // 从swap中读回后没有被修改过的页面仍然持有原来的swap槽, 槽中的内容依然有效, 不用写入
+    if (page_idx == SIZE_MAX || dirty)
+    {
+      // 先放弃旧的槽, frame_drop_swap_cache()会遍历到这个页面, 不能再放弃一次
+      if (page_idx != SIZE_MAX)
+      {
+        swap_free(page_idx);
+        pnode->swap_pg_idx = SIZE_MAX;
+      }
+      if (swap_full())
+        frame_drop_swap_cache();
+      page_idx = swap_in(kpage);
+    }
+  }
   // 将此页的"Present"标志位清零, 确保下一次进程访问该页面时会发生Page Fault
   // IMPORTANT 如果线程t已经死亡, 那么我们不能访问它的pagedir!
   // 使用magic监测进程是否已经被清理
@@ -118,9 +233,48 @@ frame_swap(struct thread *t, struct frame_node *fnode, bool dirty)
     pagedir_clear_page(t->pagedir, upage);
 
   pnode->swap_pg_idx  = page_idx;
-  pnode->loc          = pnode->role == SEG_MMAP ? LOC_FILE : LOC_SWAP;
+  pnode->loc          = page_idx == SIZE_MAX ? LOC_FILE : LOC_SWAP;
   pnode->frame_node   = NULL;
   fnode->page_node    = NULL;
+  return wb;
+}
+
+// 把frame_swap()驱逐的mmap页面从kpage写回文件, 调用者不能持有flist_lock
+// 写回期间frame不属于任何页面, 不会被驱逐
+static void
+frame_mmap_writeback(struct mmap_wb *wb, const void *kpage)
+{
+  if (inode_write_at(wb->inode, kpage, wb->bytes, wb->ofs) != (off_t) wb->bytes)
+    PANIC("frame_mmap_writeback(): Cannot write back to file!\n");
+
+  lock_acquire(&mmap_wb_lock);
+  list_remove(&wb->elem);
+  cond_broadcast(&mmap_wb_done, &mmap_wb_lock);
+  lock_release(&mmap_wb_lock);
+
+  inode_close(wb->inode);
+  free(wb);
+}
+
+// 等待inode中ofs处被驱逐的mmap页面写回完成, 在从文件中读入这一页之前调用
+void
+frame_mmap_wait(struct inode *inode, off_t ofs)
+{
+  lock_acquire(&mmap_wb_lock);
+  for (;;)
+  {
+    struct list_elem *e;
+    for (e = list_begin(&mmap_wb_list); e != list_end(&mmap_wb_list); e = list_next(e))
+    {
+      struct mmap_wb *wb = list_entry(e, struct mmap_wb, elem);
+      if (wb->inode == inode && wb->ofs == ofs)
+        break;
+    }
+    if (e == list_end(&mmap_wb_list))
+      break;
+    cond_wait(&mmap_wb_done, &mmap_wb_lock);
+  }
+  lock_release(&mmap_wb_lock);
 }
 
 // 在当前的frame table中按照[改进版]Clock算法驱逐出一页(放入swap磁盘)
@@ -137,9 +291,8 @@ frame_evict(uint32_t flags)
   bool second_turn = false;
   bool evictable  = !(flags & FRM_NO_EVICT);
 
-  struct list_elem *old_ptr = flist_ptr;
-  
   lock_acquire(&flist_lock);
+  struct list_elem *old_ptr = flist_ptr;
   for (;;)
   {
     // 我们的链表是有头尾节点的, 头尾节点是不在任何node中的
@@ -148,48 +301,71 @@ frame_evict(uint32_t flags)
       flist_ptr = list_begin(&frame_list);
 
     fnode = list_entry(flist_ptr, struct frame_node, elem);
-    void *upage = fnode->page_node->upage;
-    // 必须按照进程来访问pagedir!
-    struct thread *t = fnode->page_node->owner;
-    // 如果找不到pte则创建一个
-    // 为什么找不到? 因为进程切换, 页目录(Page Directory)也切换了!
-    // 若前一个进程
-    uint32_t *pte = lookup_page(t->pagedir, upage, false);
-    ASSERT(pte != NULL)
-    
-    bool accessed  = pagedir_is_accessed(t->pagedir, upage); 
-    bool dirty     = pagedir_is_dirty(t->pagedir, upage);
-    bool writable  = *pte & PTE_W;
-
     if (flist_ptr == old_ptr)
       second_turn = true;
 
-    if (fnode->evictable && writable)
+    // 刚分配, 还没有映射到任何页面的frame(正在被填充), 跳过
+    if (fnode->page_node == NULL && fnode->share == NULL)
     {
-        if (!second_turn)
+      flist_ptr = list_next(flist_ptr);
+      continue;
+    }
+
+    // 共享的页面被多个进程映射, 任何一个进程访问过都算作访问过
+    // Code页面是只读的, 不会是脏页; fork()留下的匿名页面被驱逐时要写入swap, 按脏页处理
+    struct thread *t = NULL;
+    void *upage      = NULL;
+    bool accessed, dirty, writable, code;
+    if (fnode->share != NULL)
+    {
+      accessed  = share_accessed(fnode->share);
+      dirty     = fnode->share->inode == NULL;
+      writable  = false;
+      code      = true;
+    }
+    else
+    {
+      upage = fnode->page_node->upage;
+      // 必须按照进程来访问pagedir!
+      t = fnode->page_node->owner;
+      // 如果找不到pte则创建一个
+      // 为什么找不到? 因为进程切换, 页目录(Page Directory)也切换了!
+      // 若前一个进程
+      uint32_t *pte = lookup_page(t->pagedir, upage, false);
+      ASSERT(pte != NULL)
+
+      accessed  = pagedir_is_accessed(t->pagedir, upage); 
+      dirty     = pagedir_is_dirty(t->pagedir, upage);
+      writable  = *pte & PTE_W;
+      code      = fnode->page_node->role == SEG_CODE;
+    }
+
+    // 只读的页面中只有Code段的页面和共享的页面可以被驱逐
+    if (fnode->evictable && (writable || code))
+    {
+      // 第一次轮询, 我们不修改access位, 只找既未被访问也没有修改的页面
+      // 已经进入第二轮, 说明我们在遍历整个frame_list后都没有找到
+      // 既未被访问也没有修改的页面, 接下来我们找一找未访问过且为脏的页面
+      if (!accessed && (second_turn || !dirty))
       {
-        // 第一次轮询, 我们不修改access位
-        if (!accessed && !dirty)
-        {
-          frame_swap(t, fnode, dirty);
-          fnode->evictable = evictable;
-          lock_release(&flist_lock);
-          return fnode;
-        }
+        struct mmap_wb *wb = NULL;
+        if (fnode->share != NULL)
+          share_evict(fnode);
+        else
+          wb = frame_swap(t, fnode, dirty);
+        fnode->evictable = evictable;
+        lock_release(&flist_lock);
+        if (wb != NULL)
+          frame_mmap_writeback(wb, fnode->kaddr);
+        return fnode;
       }
-      else 
+      // 将access位设置为false
+      if (second_turn)
       {
-        //已经进入第二轮, 说明我们在遍历整个frame_list后都没有找到
-        //既未被访问也没有修改的页面, 接下来我们找一找未访问过且为脏的页面
-        if (!accessed)
-        {
-          frame_swap(t, fnode, dirty);
-          fnode->evictable = evictable;
-          lock_release(&flist_lock);
-          return fnode;
-        }
-        // 将access位设置为false
-        pagedir_set_accessed(t->pagedir, upage, false);
+        if (fnode->share != NULL)
+          share_clear_accessed(fnode->share);
+        else
+          pagedir_set_accessed(t->pagedir, upage, false);
       }
     }
 
@@ -197,3 +373,129 @@ frame_evict(uint32_t flags)
   }    
 }
 
+// 回收至多cnt个不需要I/O就能驱逐的frame, 把它们还给用户内存池, 返回回收的个数
+// 被访问过的页面只清除accessed位, 给它们第二次机会
+static size_t
+frame_reclaim(size_t cnt)
+{
+  size_t freed = 0;
+
+  lock_acquire(&flist_lock);
+  struct list_elem *e = list_begin(&frame_list);
+  while (e != list_end(&frame_list) && freed < cnt)
+  {
+    struct frame_node *fnode = list_entry(e, struct frame_node, elem);
+    struct page_node *pnode  = fnode->page_node;
+    e = list_next(e);
+    if (!fnode->evictable)
+      continue;
+
+    if (fnode->share != NULL)
+    {
+      // 匿名的共享页面被驱逐时要写入swap, 不在这里回收
+      if (fnode->share->inode == NULL)
+        continue;
+      if (share_accessed(fnode->share))
+      {
+        share_clear_accessed(fnode->share);
+        continue;
+      }
+      share_evict(fnode);
+    }
+    else if (pnode != NULL)
+    {
+      uint32_t *pd = pnode->owner->pagedir;
+      bool clean = pnode->role != SEG_MMAP
+                   && pnode->swap_pg_idx != SIZE_MAX
+                   && !pagedir_is_dirty(pd, pnode->upage);
+      if (!clean)
+        continue;
+      if (pagedir_is_accessed(pd, pnode->upage))
+      {
+        pagedir_set_accessed(pd, pnode->upage, false);
+        continue;
+      }
+      // 不是mmap页面, 不会需要写回
+      frame_swap(pnode->owner, fnode, false);
+    }
+    else
+      continue;
+
+    frame_destroy_frame(fnode);
+    freed++;
+  }
+  lock_release(&flist_lock);
+
+  return freed;
+}
+
+// 把至多SWAP_CLUSTER_MAX个未被访问的脏页面写入连续的swap槽, 返回写入的页数
+// 页面内容在持有flist_lock时复制到bounce中, 写入期间不持有flist_lock,
+// 页面可以照常被访问, 修改和驱逐, 读取这些槽的线程会等待写入完成
+static size_t
+frame_pageout_batch(uint8_t *bounce)
+{
+  struct page_node *victims[SWAP_CLUSTER_MAX];
+  size_t cnt = 0;
+
+  lock_acquire(&flist_lock);
+  struct list_elem *e;
+  for (e = list_begin(&frame_list); e != list_end(&frame_list) && cnt < SWAP_CLUSTER_MAX;
+       e = list_next(e))
+  {
+    struct frame_node *fnode = list_entry(e, struct frame_node, elem);
+    struct page_node *pnode  = fnode->page_node;
+    if (pnode == NULL || !fnode->evictable || pnode->role == SEG_MMAP)
+      continue;
+
+    uint32_t *pd = pnode->owner->pagedir;
+    if (pagedir_is_accessed(pd, pnode->upage))
+      continue;
+    if (pnode->swap_pg_idx != SIZE_MAX && !pagedir_is_dirty(pd, pnode->upage))
+      continue;
+    victims[cnt++] = pnode;
+  }
+
+  size_t start = cnt > 0 ? swap_alloc_cluster(&cnt) : BITMAP_ERROR;
+  if (start == BITMAP_ERROR)
+  {
+    lock_release(&flist_lock);
+    return 0;
+  }
+  for (size_t i = 0; i < cnt; i++)
+  {
+    struct page_node *pnode = victims[i];
+    // 先清除dirty位再复制, 复制之后的修改会重新设置dirty位, 驱逐时就知道槽中的内容已经过时
+    pagedir_set_dirty(pnode->owner->pagedir, pnode->upage, false);
+    memcpy(bounce + i * PGSIZE, pnode->frame_node->kaddr, PGSIZE);
+    if (pnode->swap_pg_idx != SIZE_MAX)
+      swap_free(pnode->swap_pg_idx);
+    pnode->swap_pg_idx = start + i;
+  }
+  lock_release(&flist_lock);
+
+  swap_write_cluster(start, cnt, bounce);
+  return cnt;
+}
+
+static void
+frame_pageout_daemon(void *aux UNUSED)
+{
+  uint8_t *bounce = palloc_get_multiple(PAL_ASSERT, SWAP_CLUSTER_MAX);
+
+  for (;;)
+  {
+    lock_acquire(&pageout_lock);
+    while (!pageout_wanted)
+      cond_wait(&pageout_cond, &pageout_lock);
+    pageout_wanted = false;
+    lock_release(&pageout_lock);
+
+    for (int round = 0; round < PAGEOUT_ROUNDS && frame_free_cnt() < FRAME_FREE_HIGH; round++)
+    {
+      size_t want = FRAME_FREE_HIGH - frame_free_cnt();
+      if (frame_reclaim(want) < want)
+        frame_pageout_batch(bounce);
+    }
+  }
+}
@@ -5,6 +5,7 @@
 #include "virtual-memory.h"
 #include "../threads/thread.h"
 #include <stdint.h>
+#include "../filesys/off_t.h"
 
 extern uint32_t frame_cnt;
 extern struct lock flist_lock;
@@ -16,11 +17,13 @@ extern struct lock flist_lock;
 #define PG_SHARING 8
 
 extern struct list frame_list;
+struct inode;
 
 void frame_init(void);
 struct frame_node *frame_allocate_page(uint32_t *pd, uint32_t flags);
 void frame_destroy_frame(struct frame_node *fnode);
 struct frame_node *frame_evict(uint32_t flags);
+void frame_mmap_wait(struct inode *inode, off_t ofs);
 bool frame_full(void);
 
 #endif
@@ -1,6 +1,7 @@
 #include "page.h"
 #include "bitmap.h"
 #include "frame.h"
+#include "share.h"
 #include <hash.h>
 #include "../threads/malloc.h"
 #include "../filesys/file.h"
@@ -16,13 +17,17 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 struct hash process_list;
 struct lock process_list_lock;
 uint32_t page_cnt;
 
 void page_free_multiple(struct thread *t, const void *begin, const void *end);
-static void page_mmap_readin(struct thread *t, void *uaddr);
+static void page_mmap_readin(struct thread *t, void *uaddr, void *kpage);
+static bool page_exe_readin(struct thread *t, const void *upage, void *kpage);
+static bool page_exe_share(struct thread *t, struct page_node *pnode);
+static struct exe_seg_node *page_exe_seek(struct thread *t, const void *uaddr);
 static void page_update_vma(struct thread *t, enum role role);
 
 static unsigned 
@@ -108,6 +113,7 @@ page_init()
   hash_init(&process_list, page_process_hash_hash, page_process_hash_less, NULL); 
   lock_init(&process_list_lock);
   page_cnt = 0;
+  share_init();
 }
 
 void 
@@ -122,6 +128,7 @@ page_process_init(struct thread *t)
   process_node->pid = t->tid;
 
   hash_init(&process_node->page_list, page_hash_hash, page_hash_less , NULL); 
+  list_init(&process_node->seg_list);
 
   lock_acquire(&process_list_lock);
   hash_insert(&process_list, &process_node->helem);
@@ -187,10 +194,9 @@ page_update_vma(struct thread *t, enum role role)
       t->vma.stack_seg_begin = (uint8_t *)(t->vma.stack_seg_begin) - PGSIZE;
       break;
     case SEG_CODE:
-      t->vma.code_seg_end = (uint8_t *)(t->vma.code_seg_end) + PGSIZE;
-      break;
     case SEG_DATA:
-      t->vma.data_seg_end = (uint8_t *)(t->vma.data_seg_end) + PGSIZE;
+      //do nothing
+      //Code段与Data段的VMA在load()时由page_add_segment()一次设置好
       break;
     case SEG_MMAP:
       //do nothing
@@ -230,15 +236,20 @@ page_page_destructor(struct hash_elem *helem, void *aux)
 {
   struct thread *t = aux;
   struct page_node *node = hash_entry(helem, struct page_node, helem);
-  if(node->loc == LOC_MEMORY)
+  // 在swap中的页面, 以及从swap中读回后仍然持有swap槽的页面, 放弃它们的槽
+  if (node->swap_pg_idx != SIZE_MAX)
+    swap_free(node->swap_pg_idx);
+  // 共享的frame在最后一个映射者离开时才释放
+  if(node->loc == LOC_MEMORY && node->sharing)
+    share_unmap_page(node);
+  else if(node->loc == LOC_MEMORY)
     frame_destroy_frame(node->frame_node);
   pagedir_clear_page(t->pagedir, node->upage);
   free(node);
 }
 
 //完全销毁一个进程持有的Page List, 释放其所有持有的页面
-//释放所有页面对应的内存
-//TODO: 当前未实现清除swap中的内容!!!!!!!
+//释放所有页面对应的内存以及swap槽
 void 
 page_destroy_pagelist(struct thread *t)
 {
@@ -252,12 +263,77 @@ page_destroy_pagelist(struct thread *t)
   hash_destroy(&process->page_list, page_page_destructor);
   lock_release(&flist_lock);
 
+  //段中引用的文件就是进程的exec_file, 由syscall_exit()关闭
+  while (!list_empty(&process->seg_list))
+    free(list_entry(list_pop_front(&process->seg_list), struct exe_seg_node, elem));
+
   // 在process_list中删除该process
   lock_acquire(&process_list_lock);
   hash_delete(&process_list, &process->helem);
   lock_release(&process_list_lock);
 }
 
+// fork()时把parent的SPT复制给child, 在child的上下文中调用, 此时parent阻塞在fork()中
+// 内存中的页面不复制, 父子进程以只读方式共享同一个frame, 第一次写入时才在page fault中复制
+// swap中的页面引用同一个swap槽, 可执行文件中的页面各自在访问时读入
+// mmap的页面不复制, 子进程访问时重新从文件中读入, 父进程在fork()开始前已经写回了它们
+// 调用前child->exec_file必须已经设置好
+bool
+page_fork(struct thread *parent, struct thread *child)
+{
+  struct process_node *src = find_process_node(parent);
+  struct process_node *dst = find_process_node(child);
+  ASSERT(src != NULL && dst != NULL);
+
+  // 段中引用的文件换成子进程自己的exec_file
+  struct list_elem *e;
+  for (e = list_begin(&src->seg_list); e != list_end(&src->seg_list); e = list_next(e))
+  {
+    struct exe_seg_node *seg = malloc(sizeof(struct exe_seg_node));
+    if (seg == NULL)
+      return false;
+    *seg = *list_entry(e, struct exe_seg_node, elem);
+    seg->file = child->exec_file;
+    list_push_back(&dst->seg_list, &seg->elem);
+  }
+
+  // 复制期间parent的页面不能被驱逐
+  bool success = true;
+  lock_acquire(&flist_lock);
+  struct hash_iterator i;
+  hash_first(&i, &src->page_list);
+  while (success && hash_next(&i))
+  {
+    struct page_node *spage = hash_entry(hash_cur(&i), struct page_node, helem);
+    if (spage->role == SEG_MMAP || spage->loc == LOC_NOT_PRESENT)
+      continue;
+
+    struct page_node *dpage = page_add_page(child, spage->upage,
+                                            spage->sharing ? PG_SHARING : 0,
+                                            LOC_NOT_PRESENT, spage->role);
+    ASSERT(dpage != NULL);
+    switch (spage->loc)
+    {
+      case LOC_MEMORY:
+        success = share_cow_page(spage, child, dpage);
+        break;
+      case LOC_SWAP:
+        swap_ref(spage->swap_pg_idx);
+        dpage->swap_pg_idx = spage->swap_pg_idx;
+        dpage->loc         = LOC_SWAP;
+        break;
+      case LOC_FILE:
+        dpage->loc = LOC_FILE;
+        break;
+      default:
+        NOT_REACHED();
+    }
+  }
+  lock_release(&flist_lock);
+
+  return success;
+}
+
 // 在page和frame之间建立链接, 把空闲的frame分配给一个Page node
 void
 page_assign_frame(struct thread *t, struct page_node *pnode, struct frame_node *fnode, bool writable)
@@ -300,6 +376,29 @@ page_get_new_page(struct thread *t, const void *uaddr, uint32_t flags, enum role
   if (role == SEG_MMAP)
     flags |= FRM_ZERO;
 
+  // Code段与Data段的页面来自可执行文件, 地址必须落在某个段内
+  // 只读的页面在运行同一个可执行文件的进程之间共享
+  if (role == SEG_CODE || role == SEG_DATA)
+  {
+    struct exe_seg_node *seg = page_exe_seek(t, uaddr);
+    if (seg == NULL)
+      return false;
+    if (!seg->writable)
+      flags |= FRM_RO | PG_SHARING;
+  }
+
+  if (flags & PG_SHARING)
+  {
+    struct page_node *pnode = page_add_page(t, uaddr, flags, LOC_NOT_PRESENT, role);
+    ASSERT(pnode != NULL);
+    if (!page_exe_share(t, pnode))
+    {
+      page_free_page(t, uaddr);
+      return false;
+    }
+    return true;
+  }
+
   struct frame_node *fnode = frame_allocate_page(t->pagedir, flags);
   struct page_node  *pnode = page_add_page(t, uaddr, flags, LOC_NOT_PRESENT, role);
   ASSERT(pnode != NULL);
@@ -308,9 +407,22 @@ page_get_new_page(struct thread *t, const void *uaddr, uint32_t flags, enum role
     fnode = frame_evict(flags);
 
   ASSERT(fnode != NULL);
-  page_assign_frame(t, pnode, fnode, !(flags & FRM_RO));
+  // 先通过kpage填充页面再映射: 填充期间frame不属于任何页面, 不会被驱逐,
+  // 内核的写入也不会在PTE中留下dirty位
+  bool success = true;
   if (role == SEG_MMAP)
-    page_mmap_readin(t, (void *)uaddr);
+    page_mmap_readin(t, pnode->upage, fnode->kaddr);
+  else if (role == SEG_CODE || role == SEG_DATA)
+    success = page_exe_readin(t, pnode->upage, fnode->kaddr);
+  if (!success)
+  {
+    lock_acquire(&flist_lock);
+    frame_destroy_frame(fnode);
+    lock_release(&flist_lock);
+    page_free_page(t, uaddr);
+    return false;
+  }
+  page_assign_frame(t, pnode, fnode, !(flags & FRM_RO));
 
   return true;
 }
@@ -344,10 +456,13 @@ page_free_page(struct thread *t, const void *uaddr)
   struct process_node *process_node = find_process_node(t);
   ASSERT(process_node != NULL);
 
+  // 页面的frame要从frame_list中移除, 页面换出线程可能正在访问这个页面
+  lock_acquire(&flist_lock);
   struct hash_elem *helem = hash_delete(&process_node->page_list, &page_node->helem);
   ASSERT(helem != NULL);
 
   page_page_destructor(&page_node->helem, (void *)t);
+  lock_release(&flist_lock);
 }
 
 //释放一整段内存上的page
@@ -387,7 +502,7 @@ page_mmap_seek(struct thread *t, mapid_t mapid, const void *addr)
 //检查传入的uaddr在数据段中的合法性, 返回其位于哪个数据段(role)
 //若uaddr不合法, 返回SEG_UNUSED
 enum role
-page_check_role(struct thread *t, const void *uaddr, bool writable)
+page_check_role(struct thread *t, const void *uaddr)
 {
   void *esp = t->vma.stack_seg_begin;
   // 注意! 地址不包含end!
@@ -400,19 +515,6 @@ page_check_role(struct thread *t, const void *uaddr, bool writable)
   if (uaddr >= t->vma.stack_seg_begin && uaddr < t->vma.stack_seg_end)
     return SEG_STACK;
 
-  // uaddr位于Code或Data段的边缘, 且正在加载exe, 且可读写:
-  // 该段为Data段!
-  if ((uaddr == t->vma.code_seg_end || uaddr == t->vma.data_seg_end)
-      && 
-      t->vma.loading_exe 
-      && 
-      writable)
-    return SEG_DATA;
-  //如果uaddr恰好位于code段的最高位并且当前正在读取exe文件, 且只读
-  //说明访问是合法的, 且uaddr应该是code段的地址
-  if (uaddr == t->vma.code_seg_end && t->vma.loading_exe && !writable)
-    return SEG_CODE;
-
   if (uaddr == esp - 4 || uaddr == esp - 32)
     return SEG_STACK;
   
@@ -452,14 +554,108 @@ page_mmap_overlap(struct thread *t, void *addr, size_t filesize)
   return true;
 }
 
+// 记录可执行文件中从ofs开始, 映射到upage的一个段
+// 段中的页面此时并不分配, 第一次访问时由page fault从文件中读入(见page_exe_readin())
+// 同时设置Code段(只读)或Data段(可写)的VMA
+bool
+page_add_segment(struct thread *t, struct file *file, uint32_t ofs, void *upage,
+                 uint32_t read_bytes, uint32_t zero_bytes, bool writable)
+{
+  struct process_node *process_node = find_process_node(t);
+  ASSERT(process_node != NULL);
+
+  struct exe_seg_node *seg = malloc(sizeof(struct exe_seg_node));
+  if (seg == NULL)
+    return false;
+  seg->file       = file;
+  seg->ofs        = ofs;
+  seg->seg_begin  = upage;
+  seg->seg_end    = (uint8_t *)upage + read_bytes + zero_bytes;
+  seg->read_bytes = read_bytes;
+  seg->writable   = writable;
+  list_push_back(&process_node->seg_list, &seg->elem);
+
+  void **begin = writable ? &t->vma.data_seg_begin : &t->vma.code_seg_begin;
+  void **end   = writable ? &t->vma.data_seg_end   : &t->vma.code_seg_end;
+  if (*begin == NULL || seg->seg_begin < *begin)
+    *begin = seg->seg_begin;
+  if (*end == NULL || seg->seg_end > *end)
+    *end = seg->seg_end;
+
+  return true;
+}
+
+// 查找uaddr所在的可执行文件段, 不在任何段中时返回NULL
+static struct exe_seg_node *
+page_exe_seek(struct thread *t, const void *uaddr)
+{
+  struct process_node *process_node = find_process_node(t);
+  if (process_node == NULL)
+    return NULL;
+
+  struct list_elem *e;
+  for (e = list_begin(&process_node->seg_list); e != list_end(&process_node->seg_list);
+       e = list_next(e))
+  {
+    struct exe_seg_node *seg = list_entry(e, struct exe_seg_node, elem);
+    if (uaddr >= seg->seg_begin && uaddr < seg->seg_end)
+      return seg;
+  }
+  return NULL;
+}
+
+// 找到upage这一页所在的段, 并计算它在文件中的偏移与需要读取的字节数
+static struct exe_seg_node *
+page_exe_locate(struct thread *t, const void *upage, uint32_t *ofs, uint32_t *read_bytes)
+{
+  struct exe_seg_node *seg = page_exe_seek(t, upage);
+  if (seg == NULL)
+    return NULL;
+
+  uint32_t pos = (const uint8_t *)upage - (uint8_t *)seg->seg_begin;
+  *ofs = seg->ofs + pos;
+  *read_bytes = 0;
+  if (pos < seg->read_bytes)
+    *read_bytes = seg->read_bytes - pos >= PGSIZE ? PGSIZE : seg->read_bytes - pos;
+  return seg;
+}
+
+// 从可执行文件中读入upage这一页的内容, 不属于文件的部分填充0
+// 通过kpage写入, 因为Code段的页面在用户页表中是只读的
+static bool
+page_exe_readin(struct thread *t, const void *upage, void *kpage)
+{
+  uint32_t ofs, read_bytes;
+  struct exe_seg_node *seg = page_exe_locate(t, upage, &ofs, &read_bytes);
+  if (seg == NULL)
+    return false;
+
+  if (file_read_at(seg->file, kpage, read_bytes, ofs) != (off_t) read_bytes)
+    return false;
+  memset((uint8_t *)kpage + read_bytes, 0, PGSIZE - read_bytes);
+  return true;
+}
+
+// 将只读的pnode映射到共享页面表中对应的frame, 不在表中时由share_map_page()读入
+static bool
+page_exe_share(struct thread *t, struct page_node *pnode)
+{
+  uint32_t ofs, read_bytes;
+  struct exe_seg_node *seg = page_exe_locate(t, pnode->upage, &ofs, &read_bytes);
+  if (seg == NULL)
+    return false;
+  return share_map_page(t, pnode, seg->file, ofs, read_bytes);
+}
+
 inline static mapid_t
 page_allocate_mapid(struct thread *t)
 {
   return (++t->vma.mapid);
 }
 
+// 从mmap的文件中读入uaddr这一页的内容到kpage, 不属于文件的部分填充0
 static void
-page_mmap_readin(struct thread *t, void *uaddr)
+page_mmap_readin(struct thread *t, void *uaddr, void *kpage)
 {
     // 必须整页读取文件
     uaddr = pg_round_down(uaddr);
@@ -468,23 +664,16 @@ page_mmap_readin(struct thread *t, void *uaddr)
     if(mnode == NULL)
       PANIC("Cannot find mmap mapping accroding to uaddr!\n");
 
-    // IMPORTANT: 必须记录并恢复old_pos!
-    size_t old_pos = file_tell(mnode->file);
     size_t filesize = mnode->mmap_seg_end - mnode->mmap_seg_begin;
     // 只读取一页的内容
-    // 准备读取文件, 移动文件指针到pos位置
+    // 使用file_read_at()直接从pos位置读取, 不影响文件的position
     size_t pos = uaddr - mnode->mmap_seg_begin;
     uint32_t read_bytes = filesize - pos >= PGSIZE ? PGSIZE : filesize - pos;
-    file_seek(mnode->file, pos);
-    if (file_read(mnode->file, (void *)uaddr, read_bytes) != read_bytes)
-    {
-      page_free_page(t, uaddr);
-      PANIC("page_get_new_page(): read bytes for mmap file failed!\n");
-    }
-    // 清除dirty与accessed位, 避免后续误判
-    pagedir_set_accessed(t->pagedir, uaddr, false);
-    pagedir_set_dirty(t->pagedir, uaddr, false); 
-    file_seek(mnode->file, old_pos);
+    // 这一页之前被驱逐时的写回可能还没有完成
+    frame_mmap_wait(file_get_inode(mnode->file), pos);
+    if (file_read_at(mnode->file, kpage, read_bytes, pos) != (off_t) read_bytes)
+      PANIC("page_mmap_readin(): read bytes for mmap file failed!\n");
+    memset((uint8_t *)kpage + read_bytes, 0, PGSIZE - read_bytes);
 }
 
 void 
@@ -499,9 +688,7 @@ page_mmap_writeback(struct thread *t, mapid_t mapid)
   void *addr      = mnode->mmap_seg_begin;
   void *end       = mnode->mmap_seg_end; 
   size_t filesize = end - addr;
-  size_t old_pos  = mnode->file->pos;
-  // IMPORTANT: 这里必须记录并恢复文件原来的pos!!!
-  // 否则在写回后, 很可能会读取到错误的数据!!
+  // 使用file_write_at()写回, 不影响文件的position
 
   while(addr < end)
   {
@@ -512,15 +699,12 @@ page_mmap_writeback(struct thread *t, mapid_t mapid)
     {
       size_t pos = addr - mnode->mmap_seg_begin;
       uint32_t write_bytes = filesize - pos >= PGSIZE ? PGSIZE : filesize - pos;
-      file_seek(file, pos);
-      if (file_write(file, addr, write_bytes) != write_bytes)
+      if (file_write_at(file, addr, write_bytes, pos) != (off_t) write_bytes)
         PANIC("page_mmap_writeback(): Cannot write back to file!\n");
     }
 
     addr = (uint8_t *)(addr) + PGSIZE;
   }
-  file_seek(mnode->file, old_pos);
-
 }
 
 mapid_t
@@ -593,7 +777,6 @@ page_mmap_unmap_all(struct thread *t)
     e = list_next(e);
     page_mmap_unmap(t, mnode->mapid);
   }
-  cache_writeback_all();
 }
 
 void
@@ -607,6 +790,14 @@ page_set_rw(struct thread *t, const void *uaddr, bool writable)
     *pte |=  PTE_W;
 }
 
+// 向fork()后与其他进程共享的匿名页面写入, 复制一份私有的页面
+void
+page_cow_break(struct thread *t, struct page_node *pnode)
+{
+  ASSERT(pnode->sharing);
+  share_cow_break(t, pnode);
+}
+
 // 当发生Page Fault且进程发现自己持有某个页面
 // 但这个页面不在内存中, 我们需要把页面从文件或swap中拉取过来
 void
@@ -616,19 +807,29 @@ page_pull_page(struct thread *t, struct page_node *pnode)
   ASSERT(pnode->loc != LOC_MEMORY);
   ASSERT(pnode->loc != LOC_NOT_PRESENT);
 
-  struct frame_node *fnode = frame_evict(0);
-  // 默认可读写, 能被换出的页面一定是可读写的!
-  // 不可能有只读页面被换出!
-  page_assign_frame(t, pnode, fnode, true);
+  // 共享页面被驱逐后, 其他进程可能已经把它重新读入了
+  if (pnode->sharing)
+  {
+    if (!page_exe_share(t, pnode))
+      PANIC("page_pull_page(): Cannot read code page back from executable!\n");
+    return ;
+  }
 
-  //接下来把文件内容复制到内存中
-  if (pnode->role == SEG_MMAP)
-    page_mmap_readin(t, pnode->upage);
-  else if(pnode->role == SEG_STACK || pnode->role == SEG_DATA)
+  // 页面换出线程通常已经准备好了空闲的frame, 没有时才驱逐
+  struct frame_node *fnode = frame_allocate_page(t->pagedir, 0);
+  if (fnode == NULL)
+    fnode = frame_evict(0);
+  // 页面先通过kpage读入再映射: 读入期间frame不属于任何页面, 不会被驱逐
+  // swap中的页面继续持有它的swap槽, 新的PTE中dirty位为0, 被修改之前再次驱逐时不用写入
+  if (pnode->loc == LOC_SWAP)
   {
     ASSERT(pnode->swap_pg_idx != SIZE_MAX);
-    swap_out(pnode->swap_pg_idx, pnode->upage);
+    swap_out(pnode->swap_pg_idx, fnode->kaddr);
   }
+  else if (pnode->role == SEG_MMAP)
+    page_mmap_readin(t, pnode->upage, fnode->kaddr);
+  // 只读的页面都是共享的(见上), 私有的页面都可写, 被驱逐时写入swap或写回文件
+  page_assign_frame(t, pnode, fnode, true);
 
   pnode->loc = LOC_MEMORY;
 }
@@ -8,22 +8,28 @@
 #define RO 0
 #define RW 1
 
+struct file;
+
 void page_init(void);
 void page_process_init(struct thread *);
 struct page_node *page_add_page(struct thread *t, const void *uaddr, uint32_t flags, enum location loc, enum role role);
 struct page_node *page_seek(struct thread *t, const void *uaddr);
 void page_destroy_pagelist(struct thread *);
+bool page_fork(struct thread *parent, struct thread *child);
 void page_assign_frame(struct thread *t, struct page_node *pnode, struct frame_node *fnode, bool writable);
 bool page_get_new_page(struct thread *t, const void *uaddr, uint32_t flags, enum role role);
 bool page_get_multiple(struct thread *t, size_t pages, const void *uaddr, uint32_t flags, enum role role);
 void page_free_page(struct thread *t, const void *uaddr);
-enum role page_check_role(struct thread *t, const void *uaddr, bool writable);
+enum role page_check_role(struct thread *t, const void *uaddr);
+bool page_add_segment(struct thread *t, struct file *file, uint32_t ofs, void *upage,
+                      uint32_t read_bytes, uint32_t zero_bytes, bool writable);
 mapid_t page_mmap_map(struct thread *t, uint32_t fd, struct file *file, void *addr);
 void page_mmap_unmap(struct thread *t, mapid_t mapid);
 struct mmap_vma_node *page_mmap_seek(struct thread *t, mapid_t mapid, const void *addr);
 void page_mmap_unmap_all(struct thread *t);
 void page_mmap_writeback(struct thread *t, mapid_t mapid);
 void page_pull_page(struct thread *t, struct page_node *pnode);
+void page_cow_break(struct thread *t, struct page_node *pnode);
 void page_print_vm_stat();
 
 #endif // !VM_PAGE_H
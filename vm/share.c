@@ -0,0 +1,340 @@
+#include "share.h"
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "frame.h"
+#include "swap.h"
+#include "../filesys/file.h"
+#include "../threads/malloc.h"
+#include "../threads/synch.h"
+#include "../userprog/pagedir.h"
+
+// 共享页面表: 运行同一个可执行文件的进程共享只读的Code页面
+// 表中只记录当前在内存中的共享页面, 页面被驱逐或最后一个映射者退出时从表中移除
+// 被驱逐后各个映射者的page_node回到LOC_FILE, 再次访问时重新查表
+// fork()之后父子进程以只读方式共享的匿名页面也用share_node记录, 它们的inode为NULL, 不在表中
+// 第一次写入时由share_cow_break()复制, 被驱逐时写入swap, 各个映射者引用同一个swap槽
+// 锁的顺序: flist_lock -> share_lock
+static struct hash share_table;
+static struct lock share_lock;
+
+static unsigned
+share_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct share_node *s = hash_entry(e, struct share_node, helem);
+  unsigned h = hash_bytes(&s->inode, sizeof s->inode);
+  h = h * 31 + hash_int(s->ofs);
+  return h * 31 + hash_int(s->read_bytes);
+}
+
+static bool
+share_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+  const struct share_node *a = hash_entry(a_, struct share_node, helem);
+  const struct share_node *b = hash_entry(b_, struct share_node, helem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
+
+void
+share_init(void)
+{
+  hash_init(&share_table, share_hash, share_less, NULL);
+  lock_init(&share_lock);
+}
+
+// 在共享表中查找页面, 调用者必须持有share_lock
+static struct share_node *
+share_find(struct inode *inode, uint32_t ofs, uint32_t read_bytes)
+{
+  struct share_node key;
+  key.inode      = inode;
+  key.ofs        = ofs;
+  key.read_bytes = read_bytes;
+  struct hash_elem *e = hash_find(&share_table, &key.helem);
+  return e == NULL ? NULL : hash_entry(e, struct share_node, helem);
+}
+
+// 释放一个没有被任何页面映射的frame, 调用者不能持有share_lock
+static void
+share_discard_frame(struct frame_node *fnode)
+{
+  lock_acquire(&flist_lock);
+  frame_destroy_frame(fnode);
+  lock_release(&flist_lock);
+}
+
+// 将pnode映射到可执行文件file中从ofs开始的一页(只读), 读取read_bytes个字节, 其余填充0
+// 其他进程已经读入了这一页时直接映射同一个frame, 否则读入一个新的frame并加入共享表
+bool
+share_map_page(struct thread *t, struct page_node *pnode, struct file *file,
+               uint32_t ofs, uint32_t read_bytes)
+{
+  ASSERT(pnode->sharing);
+  ASSERT(pnode->frame_node == NULL);
+  struct inode *inode = file_get_inode(file);
+  struct frame_node *fnode = NULL;      //本线程读入的frame, 没用上时最后释放
+
+  lock_acquire(&share_lock);
+  struct share_node *snode = share_find(inode, ofs, read_bytes);
+  if (snode == NULL)
+  {
+    // 读文件时不能持有share_lock, 分配frame时可能要驱逐其他共享页面
+    lock_release(&share_lock);
+    fnode = frame_allocate_page(t->pagedir, FRM_RO);
+    if (fnode == NULL)
+      fnode = frame_evict(0);
+    if (file_read_at(file, fnode->kaddr, read_bytes, ofs) != (off_t) read_bytes)
+    {
+      share_discard_frame(fnode);
+      return false;
+    }
+    memset((uint8_t *)fnode->kaddr + read_bytes, 0, PGSIZE - read_bytes);
+
+    lock_acquire(&share_lock);
+    // 读文件期间其他进程可能已经读入了同一页
+    snode = share_find(inode, ofs, read_bytes);
+    if (snode == NULL && (snode = malloc(sizeof(struct share_node))) != NULL)
+    {
+      snode->inode      = inode;
+      snode->ofs        = ofs;
+      snode->read_bytes = read_bytes;
+      snode->frame_node = fnode;
+      list_init(&snode->pages);
+      hash_insert(&share_table, &snode->helem);
+      fnode->share      = snode;
+      fnode             = NULL;
+    }
+  }
+
+  bool success = snode != NULL
+                 && pagedir_set_page(t->pagedir, pnode->upage, snode->frame_node->kaddr, false);
+  if (success)
+  {
+    list_push_back(&snode->pages, &pnode->share_elem);
+    pnode->frame_node = snode->frame_node;
+    pnode->loc        = LOC_MEMORY;
+  }
+  else if (snode != NULL && list_empty(&snode->pages))
+  {
+    // 新加入的节点还没有映射者, 撤销它
+    hash_delete(&share_table, &snode->helem);
+    fnode = snode->frame_node;
+    fnode->share = NULL;
+    free(snode);
+  }
+  lock_release(&share_lock);
+
+  if (fnode != NULL)
+    share_discard_frame(fnode);
+  return success;
+}
+
+// pnode不再映射共享的frame(进程退出或释放页面), 调用者负责清除pnode的PTE
+// 最后一个映射者离开时释放frame, 调用者必须持有flist_lock
+void
+share_unmap_page(struct page_node *pnode)
+{
+  ASSERT(pnode->sharing && pnode->loc == LOC_MEMORY);
+  struct share_node *snode = pnode->frame_node->share;
+  ASSERT(snode != NULL);
+
+  lock_acquire(&share_lock);
+  list_remove(&pnode->share_elem);
+  pnode->frame_node = NULL;
+  pnode->loc        = LOC_FILE;
+  if (list_empty(&snode->pages))
+  {
+    if (snode->inode != NULL)
+      hash_delete(&share_table, &snode->helem);
+    frame_destroy_frame(snode->frame_node);
+    free(snode);
+  }
+  lock_release(&share_lock);
+}
+
+// 是否有任何一个映射者访问过该共享页面
+bool
+share_accessed(struct share_node *snode)
+{
+  bool accessed = false;
+
+  lock_acquire(&share_lock);
+  struct list_elem *e;
+  for (e = list_begin(&snode->pages); e != list_end(&snode->pages); e = list_next(e))
+  {
+    struct page_node *pnode = list_entry(e, struct page_node, share_elem);
+    if (pagedir_is_accessed(pnode->owner->pagedir, pnode->upage))
+    {
+      accessed = true;
+      break;
+    }
+  }
+  lock_release(&share_lock);
+  return accessed;
+}
+
+// 清除所有映射者的PTE中的accessed位
+void
+share_clear_accessed(struct share_node *snode)
+{
+  lock_acquire(&share_lock);
+  struct list_elem *e;
+  for (e = list_begin(&snode->pages); e != list_end(&snode->pages); e = list_next(e))
+  {
+    struct page_node *pnode = list_entry(e, struct page_node, share_elem);
+    pagedir_set_accessed(pnode->owner->pagedir, pnode->upage, false);
+  }
+  lock_release(&share_lock);
+}
+
+// 驱逐一个共享的frame: 清除所有映射者的PTE
+// 可执行文件的页面是只读的, 不需要写回, 映射者下次访问时会重新从文件中读入
+// 匿名页面写入swap一次, 映射者都引用这个swap槽, 读回时各自得到一份私有的页面
+// 返回后fnode不再属于任何页面, 调用者必须持有flist_lock
+void
+share_evict(struct frame_node *fnode)
+{
+  struct share_node *snode = fnode->share;
+  ASSERT(snode != NULL);
+
+  bool anonymous  = snode->inode == NULL;
+  size_t page_idx = anonymous ? swap_in(fnode->kaddr) : SIZE_MAX;
+
+  lock_acquire(&share_lock);
+  bool first = true;
+  while (!list_empty(&snode->pages))
+  {
+    struct page_node *pnode =
+      list_entry(list_pop_front(&snode->pages), struct page_node, share_elem);
+    pagedir_clear_page(pnode->owner->pagedir, pnode->upage);
+    pnode->frame_node = NULL;
+    pnode->loc        = anonymous ? LOC_SWAP : LOC_FILE;
+    if (anonymous)
+    {
+      if (!first)
+        swap_ref(page_idx);
+      pnode->swap_pg_idx = page_idx;
+      pnode->sharing     = false;
+    }
+    first = false;
+  }
+  if (!anonymous)
+    hash_delete(&share_table, &snode->helem);
+  lock_release(&share_lock);
+
+  free(snode);
+  fnode->share     = NULL;
+  fnode->page_node = NULL;
+}
+
+// fork()时让子进程t的dst与src共享src所在的frame, 两者都映射为只读
+// src原本是私有页面时为它的frame创建一个匿名的share_node, 并把src的PTE也改为只读
+// src已经是共享页面时(可执行文件的页面, 或者之前fork()留下的匿名页面)直接加入映射者列表
+// 调用者必须持有flist_lock, 且src的持有者没有在运行
+bool
+share_cow_page(struct page_node *src, struct thread *t, struct page_node *dst)
+{
+  ASSERT(src->loc == LOC_MEMORY);
+  struct frame_node *fnode = src->frame_node;
+
+  if (!pagedir_set_page(t->pagedir, dst->upage, fnode->kaddr, false))
+    return false;
+
+  lock_acquire(&share_lock);
+  struct share_node *snode = fnode->share;
+  if (snode == NULL)
+  {
+    snode = malloc(sizeof(struct share_node));
+    if (snode == NULL)
+    {
+      lock_release(&share_lock);
+      pagedir_clear_page(t->pagedir, dst->upage);
+      return false;
+    }
+    snode->inode      = NULL;
+    snode->ofs        = 0;
+    snode->read_bytes = 0;
+    snode->frame_node = fnode;
+    list_init(&snode->pages);
+    fnode->share      = snode;
+    fnode->page_node  = NULL;
+
+    // 共享的匿名页面被驱逐时重新写入swap, 不再使用src缓存的swap槽
+    if (src->swap_pg_idx != SIZE_MAX)
+    {
+      swap_free(src->swap_pg_idx);
+      src->swap_pg_idx = SIZE_MAX;
+    }
+    src->sharing = true;
+    list_push_back(&snode->pages, &src->share_elem);
+    pagedir_clear_page(src->owner->pagedir, src->upage);
+    pagedir_set_page(src->owner->pagedir, src->upage, fnode->kaddr, false);
+  }
+  list_push_back(&snode->pages, &dst->share_elem);
+  dst->sharing    = true;
+  dst->frame_node = fnode;
+  dst->loc        = LOC_MEMORY;
+  lock_release(&share_lock);
+  return true;
+}
+
+// 当前进程t向匿名的共享页面pnode写入: 复制一份私有的frame, 映射为可写
+// pnode是最后一个映射者时直接接管原来的frame, 不用复制
+// 分配frame期间页面可能被驱逐到swap中, 此时什么也不做, 重新执行的写入会把它读回
+void
+share_cow_break(struct thread *t, struct page_node *pnode)
+{
+  struct frame_node *copy = NULL;   //复制的目标, 没用上时最后释放
+
+  for (;;)
+  {
+    lock_acquire(&flist_lock);
+    if (!pnode->sharing || pnode->loc != LOC_MEMORY)
+      break;
+
+    struct frame_node *fnode = pnode->frame_node;
+    struct share_node *snode = fnode->share;
+    ASSERT(snode != NULL && snode->inode == NULL);
+
+    lock_acquire(&share_lock);
+    bool last = list_size(&snode->pages) == 1;
+    if (last || copy != NULL)
+    {
+      list_remove(&pnode->share_elem);
+      if (last)
+      {
+        free(snode);
+        fnode->share = NULL;
+      }
+      else
+      {
+        memcpy(copy->kaddr, fnode->kaddr, PGSIZE);
+        fnode = copy;
+        copy  = NULL;
+      }
+      lock_release(&share_lock);
+
+      pnode->sharing    = false;
+      pnode->frame_node = fnode;
+      fnode->page_node  = pnode;
+      pagedir_clear_page(t->pagedir, pnode->upage);
+      pagedir_set_page(t->pagedir, pnode->upage, fnode->kaddr, true);
+      break;
+    }
+    lock_release(&share_lock);
+    lock_release(&flist_lock);
+
+    // 分配frame时可能要驱逐其他页面, 不能持有flist_lock
+    copy = frame_allocate_page(t->pagedir, FRM_RW);
+    if (copy == NULL)
+      copy = frame_evict(0);
+  }
+  lock_release(&flist_lock);
+
+  if (copy != NULL)
+    share_discard_frame(copy);
+}
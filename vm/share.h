@@ -0,0 +1,20 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include "virtual-memory.h"
+#include "../threads/thread.h"
+#include <stdint.h>
+
+struct file;
+
+void share_init(void);
+bool share_map_page(struct thread *t, struct page_node *pnode, struct file *file,
+                    uint32_t ofs, uint32_t read_bytes);
+void share_unmap_page(struct page_node *pnode);
+bool share_accessed(struct share_node *snode);
+void share_clear_accessed(struct share_node *snode);
+void share_evict(struct frame_node *fnode);
+bool share_cow_page(struct page_node *src, struct thread *t, struct page_node *dst);
+void share_cow_break(struct thread *t, struct page_node *pnode);
+
+#endif // !VM_SHARE_H
@@ -1,86 +1,185 @@
 #include "swap.h"
 #include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include "../threads/malloc.h"
 #include "../threads/thread.h"
 #include "../threads/synch.h"
 #include "../threads/vaddr.h"
 #include "../devices/block.h"
 
-//单位为Byte, 共4MiB
-#define SWAP_SIZE 4194304 
 #define BITMAP_START 0
-#define SINGLE_PAGE 1 
+#define SINGLE_PAGE 1
 #define SECTOR_PER_PAGE 8
 #define FREE 0
 #define USED 1
 
 struct block *swap_disk;
 struct bitmap *swap_bitmap;
+// swap槽的引用计数, 每个记录了swap_pg_idx的页面持有一个引用
+// 页面从swap中读回后仍然持有它的槽(swap cache), 没有被修改过时再次驱逐不用写入
+// fork()之后父子进程的页面也可能引用同一个槽
+static uint8_t *swap_refcnt;
+static size_t swap_slots;
+// 由swap_write_cluster()异步写入, 还没有写完的槽, 读取它们的线程要等待写入完成
+static struct bitmap *swap_writing;
+static struct condition swap_written;
+// 保护swap_bitmap, swap_refcnt与swap_writing, 不在持有时进行I/O
+static struct lock swap_lock;
 
-void 
+void
 swap_init()
 {
   // 获取swap分区对应的磁盘
   swap_disk = block_get_role(BLOCK_SWAP);
-  // 使用bitmap管理扇区
-  // 默认分配4MiB / 4KiB = 1024页
-  swap_bitmap = bitmap_create(SWAP_SIZE / PGSIZE);
+  lock_init(&swap_lock);
+  cond_init(&swap_written);
+  // 使用bitmap管理swap槽, 每个槽是连续的8个扇区, 存放一页
+  // 槽的数量由swap磁盘的大小决定, 没有swap磁盘时为0
+  swap_slots = swap_disk != NULL ? block_size(swap_disk) / SECTOR_PER_PAGE : 0;
+  swap_bitmap = bitmap_create(swap_slots);
+  swap_writing = bitmap_create(swap_slots);
+  swap_refcnt = calloc(swap_slots, sizeof *swap_refcnt);
+  if (swap_bitmap == NULL || swap_writing == NULL || (swap_slots > 0 && swap_refcnt == NULL))
+    PANIC("swap_init(): Cannot allocate memory for %zu swap slots!\n", swap_slots);
 }
 
-// 以页为单位获取一个空闲的起始扇区号,
-// 该扇区后3个扇区应该都是空闲的
-// 每个扇区512Byte, 每页4096个Byte
-// 每页需要4个扇区存储
-static block_sector_t
-swap_get_free_sector()
+// 以页为单位获取一个空闲的swap槽, 返回槽的序号, 没有空闲的槽时返回BITMAP_ERROR
+static size_t
+swap_get_free_slot()
 {
+  lock_acquire(&swap_lock);
   size_t page_idx = bitmap_scan_and_flip(swap_bitmap, BITMAP_START, SINGLE_PAGE, FREE);
-  return page_idx * SECTOR_PER_PAGE;
+  if (page_idx != BITMAP_ERROR)
+    swap_refcnt[page_idx] = 1;
+  lock_release(&swap_lock);
+  return page_idx;
 }
 
-// 释放第page_idx位
-// 将扇区标记为可用
-static void
-swap_free_used_sector(size_t page_idx)
+// 是否还有空闲的swap槽
+bool
+swap_full(void)
 {
-  // 确保释放的page_idx已经被占用
-  ASSERT(bitmap_test(swap_bitmap, page_idx) == USED);
-  bitmap_reset(swap_bitmap, page_idx);
+  lock_acquire(&swap_lock);
+  bool full = !bitmap_contains(swap_bitmap, BITMAP_START, swap_slots, FREE);
+  lock_release(&swap_lock);
+  return full;
 }
 
-// 将起始位置位于uaddr的页面换入swap磁盘中
+// 将kpage处的页面写入一个空闲的swap槽中
 // 并返回page_idx
-size_t 
+size_t
 swap_in(const void *kpage)
 {
   ASSERT(pg_ofs(kpage) == 0);
-  block_sector_t free_sector_begin = swap_get_free_sector();
-  ASSERT(free_sector_begin != BITMAP_ERROR);
-  size_t page_idx = free_sector_begin / SECTOR_PER_PAGE;
+  size_t page_idx = swap_get_free_slot();
+  if (page_idx == BITMAP_ERROR)
+    PANIC("swap_in(): Swap disk is full!\n");
+
+  // 一条命令写入整页的8个扇区
+  const void *buffers[SECTOR_PER_PAGE];
+  for (int i = 0; i < SECTOR_PER_PAGE; i++)
+    buffers[i] = kpage + i * BLOCK_SECTOR_SIZE;
+  enum block_io_class old = block_set_io_class(BLOCK_IO_SWAP);
+  block_write_multi(swap_disk, page_idx * SECTOR_PER_PAGE, SECTOR_PER_PAGE, buffers);
+  block_set_io_class(old);
+
+  return page_idx;
+}
 
-  for (int i = SECTOR_PER_PAGE; i > 0; i--)
+// 分配至多*cnt个连续的swap槽, 返回第一个槽的序号, 实际分配的个数写回*cnt
+// 连续的空闲槽不够时个数逐次减半, 一个也分配不到时返回BITMAP_ERROR
+// 每个槽有两个引用: 一个属于调用者把它交给的页面, 另一个在swap_write_cluster()写完时放弃
+size_t
+swap_alloc_cluster(size_t *cnt)
+{
+  ASSERT(*cnt <= SWAP_CLUSTER_MAX);
+  size_t start = BITMAP_ERROR;
+
+  lock_acquire(&swap_lock);
+  for (; *cnt > 0; *cnt /= 2)
+  {
+    start = bitmap_scan_and_flip(swap_bitmap, BITMAP_START, *cnt, FREE);
+    if (start != BITMAP_ERROR)
+      break;
+  }
+  if (start != BITMAP_ERROR)
   {
-    block_write(swap_disk, free_sector_begin, kpage);
-    free_sector_begin += 1;
-    kpage += BLOCK_SECTOR_SIZE;
+    for (size_t i = 0; i < *cnt; i++)
+      swap_refcnt[start + i] = 2;
+    bitmap_set_multiple(swap_writing, start, *cnt, true);
   }
+  lock_release(&swap_lock);
+  return start;
+}
 
-  return page_idx;
+// 把pages处连续的cnt页写入swap_alloc_cluster()分配的从start开始的槽, 只用一条命令
+// 写完之前读取这些槽的swap_out()会等待
+void
+swap_write_cluster(size_t start, size_t cnt, const void *pages)
+{
+  ASSERT(cnt <= SWAP_CLUSTER_MAX);
+  ASSERT(pg_ofs(pages) == 0);
+
+  const void *buffers[SWAP_CLUSTER_MAX * SECTOR_PER_PAGE];
+  for (size_t i = 0; i < cnt * SECTOR_PER_PAGE; i++)
+    buffers[i] = (const uint8_t *)pages + i * BLOCK_SECTOR_SIZE;
+  enum block_io_class old = block_set_io_class(BLOCK_IO_SWAP);
+  block_write_multi(swap_disk, start * SECTOR_PER_PAGE, cnt * SECTOR_PER_PAGE, buffers);
+  block_set_io_class(old);
+
+  lock_acquire(&swap_lock);
+  bitmap_set_multiple(swap_writing, start, cnt, false);
+  for (size_t i = start; i < start + cnt; i++)
+    if (--swap_refcnt[i] == 0)
+      bitmap_reset(swap_bitmap, i);
+  cond_broadcast(&swap_written, &swap_lock);
+  lock_release(&swap_lock);
+}
+
+// 又一个页面引用了page_idx处的swap槽
+void
+swap_ref(size_t page_idx)
+{
+  lock_acquire(&swap_lock);
+  ASSERT(bitmap_test(swap_bitmap, page_idx) == USED);
+  ASSERT(swap_refcnt[page_idx] < UINT8_MAX);
+  swap_refcnt[page_idx]++;
+  lock_release(&swap_lock);
+}
+
+// 放弃对page_idx处swap槽的引用, 最后一个引用者放弃时释放该槽
+void
+swap_free(size_t page_idx)
+{
+  lock_acquire(&swap_lock);
+  // 确保释放的page_idx已经被占用
+  ASSERT(bitmap_test(swap_bitmap, page_idx) == USED);
+  ASSERT(swap_refcnt[page_idx] > 0);
+  if (--swap_refcnt[page_idx] == 0)
+    bitmap_reset(swap_bitmap, page_idx);
+  lock_release(&swap_lock);
 }
 
 // 将swap磁盘中对应页面序号为page_idx的页面读取到upage中
+// 不释放swap槽, 调用者仍然持有它的引用
 void
 swap_out(size_t page_idx, void *upage)
 {
   ASSERT(pg_ofs(upage) == 0);
   block_sector_t sector = page_idx * SECTOR_PER_PAGE;
 
-  for (int i = SECTOR_PER_PAGE; i > 0; i--)
-  {
-    block_read(swap_disk, sector, upage);
-    sector += 1;
-    upage += BLOCK_SECTOR_SIZE;
-  }
+  lock_acquire(&swap_lock);
+  while (bitmap_test(swap_writing, page_idx))
+    cond_wait(&swap_written, &swap_lock);
+  lock_release(&swap_lock);
 
-  swap_free_used_sector(page_idx);
+  // 一条命令读取整页的8个扇区
+  void *buffers[SECTOR_PER_PAGE];
+  for (int i = 0; i < SECTOR_PER_PAGE; i++)
+    buffers[i] = upage + i * BLOCK_SECTOR_SIZE;
+  enum block_io_class old = block_set_io_class(BLOCK_IO_SWAP);
+  block_read_multi(swap_disk, sector, SECTOR_PER_PAGE, buffers);
+  block_set_io_class(old);
 }
 
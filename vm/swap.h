@@ -1,10 +1,19 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+// 一次批量写入的最多页数, 8个扇区一页, 在一条IDE命令(256个扇区)之内
+#define SWAP_CLUSTER_MAX 16
+
 void swap_init();
 size_t swap_in(const void *upage);
+void swap_ref(size_t page_idx);
+void swap_free(size_t page_idx);
+bool swap_full(void);
+size_t swap_alloc_cluster(size_t *cnt);
+void swap_write_cluster(size_t start, size_t cnt, const void *pages);
 void swap_out(size_t page_idx, void *kpage);
 
 #endif // !VM_SWAP_H
@@ -39,15 +39,41 @@ struct frame_node
   bool avail;
   void *kaddr;                    //用户页面映射的内核页面的内核虚拟地址
   struct page_node *page_node;    //被某个进程持有的, 辅助页表的页面对象
+  struct share_node *share;       //被多个进程共享时指向共享表中的节点, 此时page_node为NULL
   struct list_elem elem;          
 };
 
+//共享页面表的节点, 以(可执行文件的inode, 页面在文件中的偏移, 读取的字节数)为键
+//同一个可执行文件的只读Code页面在所有运行它的进程之间共享同一个frame
+struct share_node
+{
+  struct inode *inode;
+  uint32_t ofs;
+  uint32_t read_bytes;
+  struct frame_node *frame_node;  //共享的frame
+  struct list pages;              //映射了该frame的所有页面(page_node)
+  struct hash_elem helem;
+};
+
+//可执行文件中的一个段, 由load()记录, 段中的页面在第一次被访问时才从文件中读入
+struct exe_seg_node
+{
+  struct file *file;                //可执行文件, 由进程的exec_file持有
+  uint32_t ofs;                     //段在文件中的偏移, 页对齐
+  void *seg_begin;                  //段的起始用户虚拟地址, 页对齐
+  void *seg_end;
+  uint32_t read_bytes;              //从文件中读取的字节数, 段中其余的部分填充0
+  bool writable;
+  struct list_elem elem;
+};
+
 //Supplemental Page Table第一级节点
 //以线程为索引, 维护每个线程持有的页面列表
 struct process_node
 {
   pid_t pid;                //用户进程的pid
   struct hash page_list;    //该进场持有的页面列表
+  struct list seg_list;     //可执行文件的各个段(exe_seg_node)
   struct hash_elem helem;
 };
 
@@ -63,6 +89,7 @@ struct page_node
   void *upage;                      //页面的用户虚拟地址, 低12位为0
                                     //用户虚拟地址(uaddr)的高20位(Page Directory Index + Page Table Index), 
   struct frame_node* frame_node;    //如果页面在内存中, 指向一个物理frame对象, 不在内存中则为NULL
+  struct list_elem share_elem;      //sharing为true且在内存中时, 位于share_node的pages中
   struct hash_elem helem;         
 };
 